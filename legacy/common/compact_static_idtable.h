@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+
+/// \struct CompactIndex
+/// \brief smallest unsigned type able to address N slots, keeping the maximum value as invalid index
+template <unsigned int N>
+struct CompactIndex {
+    typedef typename std::conditional<(N<UINT8_MAX), uint8_t,
+            typename std::conditional<(N<UINT16_MAX), uint16_t, uint32_t>::type>::type type;
+};
+
+/// \struct CompactID
+/// \brief opaque identifier used as a handle for the objects of a CompactStaticIDTable
+/// \details the index has the smallest width able to address N objects; the generation is at least
+/// 16 bits wide, to make the reuse of a stale handle unlikely.
+template <unsigned int N>
+struct CompactID {
+    typedef typename CompactIndex<N>::type index_type;
+    typedef typename std::conditional<(sizeof(index_type)<2), uint16_t, index_type>::type generation_type;
+
+    index_type      index      = index_type(-1);
+    generation_type generation = generation_type(-1);
+
+    CompactID() {}
+    CompactID(index_type idx, generation_type gen)
+    : index(idx), generation(gen) {}
+};
+
+template <unsigned int N>
+inline bool valid(CompactID<N> id) {
+    return id.index!=typename CompactID<N>::index_type(-1);
+}
+
+
+/// \struct CompactStaticIDTable
+/// \brief lookup table from IDs to objects, with assigned maximum size and uninitialized storage
+/// \details this is a variation of the StaticIDTable: objects are constructed only when added and destroyed
+/// when removed, and the indices/handles use the narrowest types able to address N objects.
+/// Creating a table is O(1): slots are put in use incrementally, and reused through the free list.
+template <typename T, unsigned int N>
+struct CompactStaticIDTable {
+    typedef CompactID<N>                        id_type;
+    typedef typename id_type::index_type        index_type;
+    typedef typename id_type::generation_type   generation_type;
+
+    CompactStaticIDTable();
+    CompactStaticIDTable(const CompactStaticIDTable &other);
+    CompactStaticIDTable& operator=(const CompactStaticIDTable &other);
+    ~CompactStaticIDTable() {  clear();  }
+
+    /// create and add an object to the table
+    id_type add(const T &obj=T());
+    /// construct in place and add an object to the table
+    template <typename... Args>
+    id_type emplace(Args&&... args);
+    /// remove an object; return false if the object does not exist
+    bool remove(id_type id);
+    /// remove all the objects
+    void clear();
+    /// get an object, given its ID
+    T& get(id_type id) {  return data()[_slots[id.index].index];  }
+    /// check if an object is in the table
+    bool has(id_type id) const;
+    /// number of objects stored in the map
+    uint32_t size() const {  return _size;  }
+
+    /// contiguous array of the stored objects
+    T*       data()        {  return reinterpret_cast<T*>(_objects);  }
+    const T* data()  const {  return reinterpret_cast<const T*>(_objects);  }
+    T*       begin()       {  return data();  }
+    T*       end()         {  return data()+_size;  }
+
+    /// entry of the lookup array: index of the object if in use, index of the next free slot otherwise
+    struct Slot {
+        index_type      index;
+        generation_type generation;
+    };
+
+    typedef typename std::aligned_storage<sizeof(T),alignof(T)>::type Storage;
+
+    Storage    _objects[N];           ///< contiguous array of objects; only the first _size are constructed
+    Slot       _slots[N];             ///< lookup ID -> obj; only the first _num_slots are initialized
+    index_type _obj_to_idx_lookup[N]; ///< used to map back _objects slots to _slots
+    index_type _size;                 ///< number of objects stored
+    index_type _num_slots;            ///< number of slots used at least once
+    index_type _freelist_idx;         ///< index of the first free slot in the _slots array
+
+private:
+    /// get a free slot and link it to the object in the last position
+    id_type acquire_slot();
+};
+
+
+// CompactStaticIDTable implementation
+template <typename T, unsigned int N>
+CompactStaticIDTable<T,N>::CompactStaticIDTable()
+: _size(0), _num_slots(0), _freelist_idx(index_type(-1)) {
+    static_assert(N>0 && N<UINT32_MAX, "invalid CompactStaticIDTable size");
+}
+
+template <typename T, unsigned int N>
+CompactStaticIDTable<T,N>::CompactStaticIDTable(const CompactStaticIDTable &other)
+: _size(0), _num_slots(0), _freelist_idx(index_type(-1)) {
+    *this = other;
+}
+
+template <typename T, unsigned int N>
+CompactStaticIDTable<T,N>& CompactStaticIDTable<T,N>::operator=(const CompactStaticIDTable &other) {
+    if (this!=&other) {
+        clear();
+        for (index_type i=0; i<other._size; i++)
+            ::new(&_objects[i]) T(other.data()[i]);
+        for (index_type i=0; i<other._num_slots; i++)
+            _slots[i] = other._slots[i];
+        for (index_type i=0; i<other._size; i++)
+            _obj_to_idx_lookup[i] = other._obj_to_idx_lookup[i];
+        _size         = other._size;
+        _num_slots    = other._num_slots;
+        _freelist_idx = other._freelist_idx;
+    }
+    return *this;
+}
+
+template <typename T, unsigned int N>
+typename CompactStaticIDTable<T,N>::id_type CompactStaticIDTable<T,N>::add(const T &obj) {
+    return emplace(obj);
+}
+
+template <typename T, unsigned int N>
+template <typename... Args>
+typename CompactStaticIDTable<T,N>::id_type CompactStaticIDTable<T,N>::emplace(Args&&... args) {
+    assert(_size<N);
+    ::new(&_objects[_size]) T(std::forward<Args>(args)...);
+    return acquire_slot();
+}
+
+template <typename T, unsigned int N>
+typename CompactStaticIDTable<T,N>::id_type CompactStaticIDTable<T,N>::acquire_slot() {
+    index_type slot_idx;
+    if (_freelist_idx!=index_type(-1)) {
+        slot_idx = _freelist_idx;
+        _freelist_idx = _slots[slot_idx].index;
+    } else {
+        slot_idx = _num_slots++;
+        _slots[slot_idx].generation = 0;
+    }
+    _slots[slot_idx].index = _size;
+    _obj_to_idx_lookup[_size] = slot_idx; // keep the lookup array in sync
+    ++_size;
+    return id_type(slot_idx,_slots[slot_idx].generation);
+}
+
+template <typename T, unsigned int N>
+bool CompactStaticIDTable<T,N>::remove(id_type id) {
+    if (!has(id))
+        return false;
+    // move the last object in the hole
+    T *objects = data();
+    auto internal_idx = _slots[id.index].index;
+    --_size;
+    if (internal_idx!=_size) {
+        objects[internal_idx] = std::move(objects[_size]);
+        _obj_to_idx_lookup[internal_idx] = _obj_to_idx_lookup[_size];
+        _slots[_obj_to_idx_lookup[internal_idx]].index = internal_idx;
+    }
+    objects[_size].~T();
+    // invalidate the handles and update free list chain
+    _slots[id.index].generation++;
+    _slots[id.index].index = _freelist_idx;
+    _freelist_idx = id.index;
+    return true;
+}
+
+template <typename T, unsigned int N>
+void CompactStaticIDTable<T,N>::clear() {
+    while (_size>0)
+        remove(id_type(_obj_to_idx_lookup[_size-1],_slots[_obj_to_idx_lookup[_size-1]].generation));
+}
+
+template <typename T, unsigned int N>
+bool CompactStaticIDTable<T,N>::has(id_type id) const {
+    if (id.index>=_num_slots || _slots[id.index].generation!=id.generation)
+        return false;
+    // the slot must be in use (free slots point to the free list)
+    auto internal_idx = _slots[id.index].index;
+    return internal_idx<_size && _obj_to_idx_lookup[internal_idx]==id.index;
+}
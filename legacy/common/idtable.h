@@ -1,7 +1,49 @@
 #pragma once
 #include "foundation_types.h"
+#include "mapped_file.h"
 
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <vector>
+#include <type_traits>
+
+
+/// \struct IDTableFileHeader
+/// \brief header of the binary snapshot of an IDTable
+/// \details the header is followed by the _ids, _obj_to_idx_lookup and _objects arrays, each one
+/// starting at the given offset (aligned to the cache line size) from the beginning of the file.
+struct IDTableFileHeader {
+    static const uint32_t current_version = 1;
+
+    char     magic[8];     ///< "IDTABLE"
+    uint32_t version;      ///< version of the binary layout
+    uint32_t object_size;  ///< sizeof the stored type, used as a sanity check on load
+    uint32_t object_align; ///< alignof the stored type
+    uint32_t size;
+    uint32_t freelist_idx;
+    uint32_t next_uuid;
+    uint64_t num_ids;      ///< length of the _ids array
+    uint64_t num_objects;  ///< length of the _obj_to_idx_lookup and _objects arrays
+    uint64_t ids_offset;
+    uint64_t lookup_offset;
+    uint64_t objects_offset;
+};
+
+
+/// \enum ChangeType
+enum class ChangeType : uint8_t {
+    ADDED = 0, ///< object added to the table
+    MODIFIED,  ///< object accessed with get_mut
+    REMOVED    ///< object removed from the table
+};
+
+/// \struct Change
+/// \brief entry of the change log of an IDTable
+struct Change {
+    ID         id;
+    ChangeType type;
+};
 
 
 /// \struct IDTable
@@ -19,18 +61,63 @@ struct IDTable {
     bool remove(ID id);
     /// get an object, given its ID
     T& get(ID id);
+    /// get an object for modification, given its ID. The object is marked as modified for the change consumers
+    T& get_mut(ID id);
     /// check if an object is in the table
     bool has(ID id) const;
     /// number of objects stored in the map.
     /// \details the size of the internal ids_ and objects_ arrays can be bigger than this.
     uint32_t size() const {  return _size;  }
 
-    std::vector<ID>       _ids;               ///< id map used for storing uuid and as a lookup ID -> obj
-    std::vector<uint32_t> _obj_to_idx_lookup; ///< used to map back _objects slots to _ids
-    std::vector<T>        _objects;           ///< contiguous array of objects
-    uint32_t              _size;              ///< number of objects stored
-    uint32_t              _freelist_idx;      ///< index of the first free slot in the _ids array
-    uint32_t              _next_uuid;         ///< \todo replace with a per-slot index
+    /// write a binary snapshot of the table. Only available for trivially copyable types.
+    /// \return false if the file cannot be written
+    bool save(const char *path) const;
+    /// replace the content of the table with a snapshot created with save().
+    /// \details the file is memory mapped copy-on-write and its arrays are used in place, so only the
+    /// pages actually accessed are read from disk. Growing the table moves the affected array to the heap.
+    /// \return false if the file cannot be mapped or is not compatible with the table type
+    bool load(const char *path);
+
+    /// register a consumer of the change log. Changes are tracked only while there is at least one consumer.
+    /// \return the handle of the consumer; its checkpoint is set to the current state of the table
+    uint32_t add_consumer();
+    /// unregister a consumer of the change log
+    void remove_consumer(uint32_t consumer);
+    /// call fn(const Change&) for every change since the last checkpoint of the given consumer.
+    /// \details repeated modifications of an object are logged once only until the next checkpoint of any
+    /// consumer, so a consumer lagging behind the others can see the same object MODIFIED several times.
+    /// ADDED and MODIFIED entries can refer to objects that have been removed afterwards (a REMOVED entry follows).
+    template <typename F>
+    void for_each_change(uint32_t consumer, F fn) const;
+    /// move the checkpoint of the given consumer to the current state of the table
+    void clear_changes(uint32_t consumer);
+
+    template <typename U>
+    using Array = std::vector<U,MappedAllocator<U>>;
+
+    Array<ID>       _ids;               ///< id map used for storing uuid and as a lookup ID -> obj
+    Array<uint32_t> _obj_to_idx_lookup; ///< used to map back _objects slots to _ids
+    Array<T>        _objects;           ///< contiguous array of objects
+    uint32_t        _size;              ///< number of objects stored
+    uint32_t        _freelist_idx;      ///< index of the first free slot in the _ids array
+    uint32_t        _next_uuid;         ///< \todo replace with a per-slot index
+
+    std::vector<Change>   _changes;        ///< change log shared by all the consumers
+    std::vector<uint64_t> _change_pos;     ///< per _ids slot, log position (+1) of the last change of the object
+    std::vector<uint64_t> _checkpoints;    ///< per consumer, log position of the first change not yet consumed
+    uint64_t              _changes_base=0; ///< log position of _changes[0]
+    uint64_t              _last_checkpoint=0; ///< most recent checkpoint among the consumers
+    uint32_t              _num_consumers=0;
+
+private:
+    /// append an entry to the change log, if there are consumers
+    void log_change(ID id, ChangeType type);
+    /// update the checkpoint bounds and discard the part of the change log already seen by all the consumers
+    void compact_changes();
+
+    /// create an array using the given region of the file as storage
+    template <typename U>
+    static Array<U> adopt(const std::shared_ptr<MappedFile> &file, uint64_t offset, uint64_t len);
 };
 
 
@@ -47,11 +134,13 @@ bool IDTable<T>::remove(ID id) {
         // swap with last;
         auto internal_idx = _ids[id.index].index;
         _objects[internal_idx] = _objects[--_size];
-        _ids[_obj_to_idx_lookup[_size]].index = internal_idx;
+        _obj_to_idx_lookup[internal_idx] = _obj_to_idx_lookup[_size];
+        _ids[_obj_to_idx_lookup[internal_idx]].index = internal_idx;
         // update free list chain
         _ids[id.index].index = UINT32_MAX;
         _ids[id.index].next_free_idx = _freelist_idx;
         _freelist_idx = id.index;
+        log_change(id,ChangeType::REMOVED);
         return true;
     }
     return false;
@@ -74,9 +163,11 @@ ID IDTable<T>::add(const T &obj) {
         uint32_t next_free_idx = _ids[_freelist_idx].next_free_idx;
         _ids[_freelist_idx] = id;
         id.index = _freelist_idx;
+        _freelist_idx = next_free_idx;
     }
     _obj_to_idx_lookup[_size] = id.index; // keep the lookup array in sync
     ++_size;
+    log_change(id,ChangeType::ADDED);
     return id;
 }
 
@@ -85,8 +176,171 @@ T& IDTable<T>::get(ID id) {
     return _objects[_ids[id.index].index];
 }
 
+template <typename T>
+T& IDTable<T>::get_mut(ID id) {
+    log_change(id,ChangeType::MODIFIED);
+    return _objects[_ids[id.index].index];
+}
+
 template <typename T>
 bool IDTable<T>::has(ID id) const {
-    return id.index<_ids.size() && _ids[id.index].internal_id == id.internal_id;
+    // free slots store the next free index in place of the internal id: check the object index too
+    return id.index<_ids.size() && _ids[id.index].index!=UINT32_MAX && _ids[id.index].internal_id == id.internal_id;
+}
+
+
+template <typename T>
+bool IDTable<T>::save(const char *path) const {
+    static_assert(std::is_trivially_copyable<T>::value, "IDTable snapshots require a trivially copyable type");
+    auto align = [](uint64_t offset) {  return (offset+CACHE_LINE_SIZE-1)/CACHE_LINE_SIZE*CACHE_LINE_SIZE;  };
+    IDTableFileHeader header;
+    memset(&header,0,sizeof(header));
+    strncpy(header.magic,"IDTABLE",sizeof(header.magic));
+    header.version        = IDTableFileHeader::current_version;
+    header.object_size    = sizeof(T);
+    header.object_align   = alignof(T);
+    header.size           = _size;
+    header.freelist_idx   = _freelist_idx;
+    header.next_uuid      = _next_uuid;
+    header.num_ids        = _ids.size();
+    header.num_objects    = _objects.size();
+    header.ids_offset     = align(sizeof(header));
+    header.lookup_offset  = align(header.ids_offset+header.num_ids*sizeof(ID));
+    header.objects_offset = align(header.lookup_offset+header.num_objects*sizeof(uint32_t));
+    FILE *fp = fopen(path,"wb");
+    if (!fp)
+        return false;
+    bool ok = fwrite(&header,sizeof(header),1,fp)==1;
+    auto write_at = [&](uint64_t offset, const void *data, size_t len) {
+        ok = ok && fseek(fp,offset,SEEK_SET)==0 && (len==0 || fwrite(data,len,1,fp)==1);
+    };
+    write_at(header.ids_offset,_ids.data(),_ids.size()*sizeof(ID));
+    write_at(header.lookup_offset,_obj_to_idx_lookup.data(),_obj_to_idx_lookup.size()*sizeof(uint32_t));
+    write_at(header.objects_offset,_objects.data(),_objects.size()*sizeof(T));
+    return fclose(fp)==0 && ok;
+}
+
+template <typename T>
+bool IDTable<T>::load(const char *path) {
+    static_assert(std::is_trivially_copyable<T>::value, "IDTable snapshots require a trivially copyable type");
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path) || file->size()<sizeof(IDTableFileHeader))
+        return false;
+    IDTableFileHeader header;
+    memcpy(&header,file->data(),sizeof(header));
+    // the arrays must be inside the file and cache line aligned; written without sums, that could overflow
+    uint64_t file_size = file->size();
+    auto fits = [file_size](uint64_t offset, uint64_t num, uint64_t elem_size) {
+        return offset%CACHE_LINE_SIZE==0 && offset<=file_size && num<=(file_size-offset)/elem_size;
+    };
+    if (strncmp(header.magic,"IDTABLE",sizeof(header.magic))!=0
+        || header.version!=IDTableFileHeader::current_version
+        || header.object_size!=sizeof(T) || header.object_align!=alignof(T)
+        || !fits(header.ids_offset,header.num_ids,sizeof(ID))
+        || !fits(header.lookup_offset,header.num_objects,sizeof(uint32_t))
+        || !fits(header.objects_offset,header.num_objects,sizeof(T)))
+        return false;
+    // the indices are 32 bit, and the table state must refer to the arrays
+    if (header.num_ids>UINT32_MAX || header.num_objects>UINT32_MAX
+        || header.size>header.num_objects
+        || (header.freelist_idx!=UINT32_MAX && header.freelist_idx>=header.num_ids))
+        return false;
+    _ids               = adopt<ID>(file,header.ids_offset,header.num_ids);
+    _obj_to_idx_lookup = adopt<uint32_t>(file,header.lookup_offset,header.num_objects);
+    _objects           = adopt<T>(file,header.objects_offset,header.num_objects);
+    _size              = header.size;
+    _freelist_idx      = header.freelist_idx;
+    _next_uuid         = header.next_uuid;
+    // the loaded objects are unrelated to the change log: restart it from the new state
+    _changes_base += _changes.size();
+    _changes.clear();
+    _change_pos.clear();
+    for (auto &c: _checkpoints)
+        if (c!=UINT64_MAX)
+            c = _changes_base;
+    _last_checkpoint = _changes_base;
+    return true;
 }
 
+template <typename T>
+template <typename U>
+typename IDTable<T>::template Array<U> IDTable<T>::adopt(const std::shared_ptr<MappedFile> &file, uint64_t offset, uint64_t len) {
+    U *region = reinterpret_cast<U*>(file->data()+offset);
+    Array<U> ary(MappedAllocator<U>(file,region,len));
+    if (len>0) {
+        ary.reserve(len);
+        ary.resize(len);
+        // the standard library did not request the exact length: fall back to a copy
+        if (ary.data()!=region)
+            memcpy(ary.data(),region,len*sizeof(U));
+    }
+    return ary;
+}
+
+template <typename T>
+uint32_t IDTable<T>::add_consumer() {
+    uint64_t pos = _changes_base+_changes.size();
+    ++_num_consumers;
+    _last_checkpoint = pos;
+    for (uint32_t i=0; i<_checkpoints.size(); i++) {
+        if (_checkpoints[i]==UINT64_MAX) {
+            _checkpoints[i] = pos;
+            return i;
+        }
+    }
+    _checkpoints.push_back(pos);
+    return _checkpoints.size()-1;
+}
+
+template <typename T>
+void IDTable<T>::remove_consumer(uint32_t consumer) {
+    if (consumer<_checkpoints.size() && _checkpoints[consumer]!=UINT64_MAX) {
+        _checkpoints[consumer] = UINT64_MAX;
+        --_num_consumers;
+        compact_changes();
+    }
+}
+
+template <typename T>
+template <typename F>
+void IDTable<T>::for_each_change(uint32_t consumer, F fn) const {
+    for (uint64_t i=_checkpoints[consumer]-_changes_base; i<_changes.size(); i++)
+        fn(_changes[i]);
+}
+
+template <typename T>
+void IDTable<T>::clear_changes(uint32_t consumer) {
+    _checkpoints[consumer] = _changes_base+_changes.size();
+    compact_changes();
+}
+
+template <typename T>
+void IDTable<T>::log_change(ID id, ChangeType type) {
+    if (_num_consumers==0)
+        return;
+    if (id.index>=_change_pos.size())
+        _change_pos.resize(_ids.size(),0);
+    // a modification already logged after the most recent checkpoint is visible to every consumer
+    if (type==ChangeType::MODIFIED && _change_pos[id.index]>_last_checkpoint)
+        return;
+    _changes.push_back(Change {id,type});
+    _change_pos[id.index] = _changes_base+_changes.size();
+}
+
+template <typename T>
+void IDTable<T>::compact_changes() {
+    uint64_t first_checkpoint = _changes_base+_changes.size();
+    _last_checkpoint = 0;
+    for (auto c: _checkpoints) {
+        if (c==UINT64_MAX)
+            continue;
+        first_checkpoint = std::min(first_checkpoint,c);
+        _last_checkpoint = std::max(_last_checkpoint,c);
+    }
+    // erase the consumed entries only when they are at least half of the log, to keep the cost amortized
+    uint64_t consumed = first_checkpoint-_changes_base;
+    if (consumed>0 && consumed*2>=_changes.size()) {
+        _changes.erase(_changes.begin(),_changes.begin()+consumed);
+        _changes_base = first_checkpoint;
+    }
+}
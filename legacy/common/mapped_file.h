@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <new>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+/// \class MappedFile
+/// \brief file mapped in memory in private (copy-on-write) mode
+/// \details the content of the file is loaded lazily by the OS when the pages are touched; writes
+/// to the mapped memory are never propagated to the file.\n
+/// On platforms without mmap the file is read in a heap buffer.
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    ~MappedFile() {  close();  }
+
+    /// map the given file. Return false if the file cannot be opened or mapped
+    bool open(const char *path);
+    /// unmap the file
+    void close();
+
+    char*  data() const {  return _data;  }
+    size_t size() const {  return _size;  }
+    /// check if the given pointer is inside the mapped region
+    bool contains(const void *p) const {  return p>=_data && p<_data+_size;  }
+
+private:
+    char  *_data = nullptr;
+    size_t _size = 0;
+};
+
+
+/// \struct MappedAllocator
+/// \brief std allocator that can adopt a region of a MappedFile as storage of a container
+/// \details the region is handed out on the first allocation of the expected length, and the elements
+/// placed in it are neither default-constructed nor deallocated. As soon as the container grows, its
+/// content is moved to the heap as usual, leaving the mapping untouched.\n
+/// The adopted region must contain valid objects of a trivially copyable type.
+template <typename T>
+struct MappedAllocator {
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    MappedAllocator() {}
+    MappedAllocator(std::shared_ptr<MappedFile> file, T *region, size_t len)
+    : _file(std::move(file)), _adopt(region), _adopt_len(len) {}
+    template <typename U>
+    MappedAllocator(const MappedAllocator<U> &other)
+    : _file(other._file) {}
+
+    T* allocate(size_t n) {
+        // the region can be adopted only by the first allocation
+        T *p = n==_adopt_len ? _adopt : nullptr;
+        _adopt = nullptr;
+        return p ? p : static_cast<T*>(::operator new(n*sizeof(T)));
+    }
+    void deallocate(T *p, size_t) {
+        if (!mapped(p))
+            ::operator delete(p);
+    }
+    template <typename U, typename... Args>
+    void construct(U *p, Args&&... args) {
+        ::new((void*)p) U(std::forward<Args>(args)...);
+    }
+    /// value-initialization is skipped for the objects stored in the mapped file
+    template <typename U>
+    void construct(U *p) {
+        if (!mapped(p))
+            ::new((void*)p) U();
+    }
+
+    bool mapped(const void *p) const {  return _file && _file->contains(p);  }
+
+    std::shared_ptr<MappedFile> _file;        ///< mapping owning the adopted memory
+    T                          *_adopt = nullptr;
+    size_t                      _adopt_len = 0;
+};
+
+template <typename T, typename U>
+inline bool operator==(const MappedAllocator<T>&, const MappedAllocator<U>&) {  return true;  }
+template <typename T, typename U>
+inline bool operator!=(const MappedAllocator<T>&, const MappedAllocator<U>&) {  return false;  }
+
+
+// MappedFile implementation
+inline bool MappedFile::open(const char *path) {
+    close();
+#ifdef _WIN32
+    FILE *fp = fopen(path,"rb");
+    if (!fp)
+        return false;
+    fseek(fp,0,SEEK_END);
+    long len = ftell(fp);
+    fseek(fp,0,SEEK_SET);
+    _data = len>0 ? static_cast<char*>(::operator new(len)) : nullptr;
+    _size = len>0 && fread(_data,1,len,fp)==(size_t)len ? len : 0;
+    fclose(fp);
+    if (_size==0)
+        close();
+    return _size>0;
+#else
+    int fd = ::open(path,O_RDONLY);
+    if (fd<0)
+        return false;
+    struct stat s;
+    if (fstat(fd,&s)==0 && s.st_size>0) {
+        void *p = mmap(nullptr,s.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+        if (p!=MAP_FAILED) {
+            _data = static_cast<char*>(p);
+            _size = s.st_size;
+        }
+    }
+    ::close(fd); // the mapping keeps its own reference to the file
+    return _data!=nullptr;
+#endif
+}
+
+inline void MappedFile::close() {
+    if (_data) {
+#ifdef _WIN32
+        ::operator delete(_data);
+#else
+        munmap(_data,_size);
+#endif
+    }
+    _data = nullptr;
+    _size = 0;
+}
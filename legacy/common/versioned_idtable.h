@@ -0,0 +1,177 @@
+#pragma once
+#include "foundation_types.h"
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+/// \struct ChunkedArray
+/// \brief array split in fixed size chunks, shared between versions and copied on write
+/// \details copying a ChunkedArray only copies the chunk pointers. A chunk is cloned the first time it is
+/// modified while still referenced by another copy of the array.
+template <typename T, unsigned int ChunkSize>
+struct ChunkedArray {
+    typedef std::array<T,ChunkSize> Chunk;
+
+    const T& operator[](uint32_t i) const {  return (*_chunks[i/ChunkSize])[i%ChunkSize];  }
+    /// get an element for modification, cloning its chunk if shared
+    T& mut(uint32_t i) {
+        auto &chunk = _chunks[i/ChunkSize];
+        if (chunk.use_count()>1)
+            chunk = std::make_shared<Chunk>(*chunk);
+        // pair with the release of the last reader of the shared chunk
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return (*chunk)[i%ChunkSize];
+    }
+    /// make sure that the first n elements are allocated
+    void reserve(uint32_t n) {
+        while (_chunks.size()*ChunkSize<n)
+            _chunks.push_back(std::make_shared<Chunk>());
+    }
+    const Chunk* chunk(uint32_t c) const {  return _chunks[c].get();  }
+    uint32_t num_chunks() const {  return _chunks.size();  }
+
+    std::vector<std::shared_ptr<Chunk>> _chunks;
+};
+
+
+/// \struct VersionedIDTable
+/// \brief lookup table from IDs to objects, publishing immutable versions for concurrent readers
+/// \details the table has the same layout and behaviour of the IDTable, but its arrays are split in chunks
+/// shared between the versions. A single writer modifies the current version; publish() makes it
+/// visible to the readers as an immutable Snapshot. The chunks not modified since the previous publish
+/// are shared, the others are copied once when first written (copy-on-write).\n
+/// Readers can keep a snapshot for as long as they need: its chunks are released when the last
+/// reference goes away.
+template <typename T, unsigned int ChunkSize=1024>
+struct VersionedIDTable {
+
+    /// \struct Snapshot
+    /// \brief immutable version of the table
+    struct Snapshot {
+        ChunkedArray<ID,ChunkSize>       _ids;
+        ChunkedArray<uint32_t,ChunkSize> _obj_to_idx_lookup;
+        ChunkedArray<T,ChunkSize>        _objects;
+        uint32_t                         _size = 0;
+        uint32_t                         _num_ids = 0;
+        uint64_t                         _version = 0;
+
+        /// check if an object is in the snapshot
+        bool has(ID id) const {
+            // free slots store the next free index in place of the internal id: check the object index too
+            return id.index<_num_ids && _ids[id.index].index!=UINT32_MAX && _ids[id.index].internal_id == id.internal_id;
+        }
+        /// get an object, given its ID
+        const T& get(ID id) const {  return _objects[_ids[id.index].index];  }
+        /// number of objects
+        uint32_t size() const {  return _size;  }
+        /// number of publish() calls up to this version (0 before the first publish)
+        uint64_t version() const {  return _version;  }
+        /// call fn(const T&) for all the objects
+        template <typename F>
+        void for_each(F fn) const;
+    };
+
+    VersionedIDTable();
+
+    /// create and add an object to the table
+    ID add(const T &obj=T());
+    /// remove an object; return false if the object does not exist
+    bool remove(ID id);
+    /// get an object for reading, given its ID
+    const T& get(ID id) const {  return _current._objects[_current._ids[id.index].index];  }
+    /// get an object for modification, given its ID. Its chunk is cloned if shared with a published version
+    T& get_mut(ID id) {  return _current._objects.mut(_current._ids[id.index].index);  }
+    /// check if an object is in the table
+    bool has(ID id) const {  return _current.has(id);  }
+    /// number of objects stored in the table
+    uint32_t size() const {  return _current._size;  }
+
+    /// make the current state visible to the readers
+    /// \return the version of the published snapshot
+    uint64_t publish();
+    /// get the last published version. Can be called concurrently with the writer.
+    std::shared_ptr<const Snapshot> snapshot() const {  return std::atomic_load(&_published);  }
+
+    Snapshot                        _current;      ///< version modified by the writer
+    std::shared_ptr<const Snapshot> _published;    ///< last published version
+    uint32_t                        _freelist_idx; ///< index of the first free slot in the _ids array
+    uint32_t                        _next_uuid;
+};
+
+
+// ChunkedArray / Snapshot implementation
+template <typename T, unsigned int ChunkSize>
+template <typename F>
+void VersionedIDTable<T,ChunkSize>::Snapshot::for_each(F fn) const {
+    for (uint32_t c=0; c*ChunkSize<_size; c++) {
+        auto chunk = _objects.chunk(c);
+        uint32_t n = std::min(ChunkSize,_size-c*ChunkSize);
+        for (uint32_t i=0; i<n; i++)
+            fn((*chunk)[i]);
+    }
+}
+
+// VersionedIDTable implementation
+template <typename T, unsigned int ChunkSize>
+VersionedIDTable<T,ChunkSize>::VersionedIDTable()
+: _published(std::make_shared<const Snapshot>()), _freelist_idx(UINT32_MAX), _next_uuid(0) {
+}
+
+template <typename T, unsigned int ChunkSize>
+ID VersionedIDTable<T,ChunkSize>::add(const T &obj) {
+    auto &v = _current;
+    // add the new object in the first free pos of the objects array
+    v._objects.reserve(v._size+1);
+    v._obj_to_idx_lookup.reserve(v._size+1);
+    v._objects.mut(v._size) = obj;
+    // create an entry in the _ids array
+    ID id {v._size,_next_uuid++};
+    if (_freelist_idx==UINT32_MAX) {
+        v._ids.reserve(v._num_ids+1);
+        v._ids.mut(v._num_ids) = id;
+        id.index = v._num_ids++;
+    } else {
+        uint32_t next_free_idx = v._ids[_freelist_idx].next_free_idx;
+        v._ids.mut(_freelist_idx) = id;
+        id.index = _freelist_idx;
+        _freelist_idx = next_free_idx;
+    }
+    v._obj_to_idx_lookup.mut(v._size) = id.index; // keep the lookup array in sync
+    ++v._size;
+    return id;
+}
+
+template <typename T, unsigned int ChunkSize>
+bool VersionedIDTable<T,ChunkSize>::remove(ID id) {
+    if (!has(id))
+        return false;
+    auto &v = _current;
+    // swap with last
+    auto internal_idx = v._ids[id.index].index;
+    --v._size;
+    if (internal_idx!=v._size) {
+        v._objects.mut(internal_idx) = v._objects[v._size];
+        v._obj_to_idx_lookup.mut(internal_idx) = v._obj_to_idx_lookup[v._size];
+        v._ids.mut(v._obj_to_idx_lookup[internal_idx]).index = internal_idx;
+    }
+    // update free list chain
+    ID &slot = v._ids.mut(id.index);
+    slot.index = UINT32_MAX;
+    slot.next_free_idx = _freelist_idx;
+    _freelist_idx = id.index;
+    return true;
+}
+
+template <typename T, unsigned int ChunkSize>
+uint64_t VersionedIDTable<T,ChunkSize>::publish() {
+    // the new snapshot shares all the chunks with the current version
+    ++_current._version;
+    std::shared_ptr<const Snapshot> snapshot = std::make_shared<Snapshot>(_current);
+    std::atomic_store(&_published,snapshot);
+    return _current._version;
+}
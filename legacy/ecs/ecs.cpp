@@ -0,0 +1,321 @@
+#include "ecs.h"
+
+#include <cassert>
+#include <atomic>
+
+// local variables and functions
+namespace {
+
+ecs::ComponentInfo     registry[ecs::max_components];
+std::atomic<uint32_t>  num_components(0);
+
+inline uint32_t align_up(uint32_t offset, uint32_t align) {
+    return (offset+align-1)/align*align;
+}
+
+inline ecs::Signature bit(uint32_t comp) {
+    return ecs::Signature(1) << comp;
+}
+
+}
+
+
+namespace ecs {
+
+uint32_t register_component(const ComponentInfo &info) {
+    assert(info.align<=CACHE_LINE_SIZE);
+    uint32_t id = num_components++;
+    assert(id<max_components);
+    registry[id] = info;
+    return id;
+}
+
+const ComponentInfo& component_info(uint32_t component) {
+    return registry[component];
+}
+
+
+// World implementation
+
+World::World() {
+    // the empty archetype is always the first one
+    get_archetype(0);
+}
+
+World::~World() {
+    for (auto &arch: _archetypes) {
+        for (uint32_t c=0; c<arch->chunks.size(); c++) {
+            for (auto comp: arch->components)
+                for (uint32_t r=0; r<arch->chunks[c].count; r++)
+                    component_info(comp).destroy(arch->component(c,r,comp));
+            delete [] arch->chunks[c].block;
+        }
+    }
+}
+
+ID World::create() {
+    ID e = _entities.add(EntityLocation());
+    _entities.get(e) = allocate_row(0,e);
+    return e;
+}
+
+ID World::reserve() {
+    return _entities.add(EntityLocation());
+}
+
+bool World::destroy(ID e) {
+    if (!alive(e))
+        return false;
+    EntityLocation loc = _entities.get(e);
+    if (loc.archetype!=UINT32_MAX) {
+        Archetype &arch = *_archetypes[loc.archetype];
+        for (auto comp: arch.components)
+            component_info(comp).destroy(arch.component(loc.chunk,loc.row,comp));
+        free_row(loc);
+    }
+    _entities.remove(e);
+    return true;
+}
+
+void World::move_entity(ID e, Signature target) {
+    move_entity_to(e,get_archetype(target));
+}
+
+void* World::get_component(ID e, uint32_t comp) {
+    if (!alive(e))
+        return nullptr;
+    const EntityLocation &loc = _entities.get(e);
+    if (loc.archetype==UINT32_MAX || _archetypes[loc.archetype]->offsets[comp]==UINT32_MAX)
+        return nullptr;
+    return _archetypes[loc.archetype]->component(loc.chunk,loc.row,comp);
+}
+
+void* World::add_component(ID e, uint32_t comp) {
+    uint32_t src = _entities.get(e).archetype;
+    move_entity_to(e,src==UINT32_MAX ? get_archetype(bit(comp)) : get_edge(src,comp,true));
+    return get_component(e,comp);
+}
+
+bool World::remove_component(ID e, uint32_t comp) {
+    if (!get_component(e,comp))
+        return false;
+    move_entity_to(e,get_edge(_entities.get(e).archetype,comp,false));
+    return true;
+}
+
+void World::move_entity_to(ID e, uint32_t archetype) {
+    EntityLocation src = _entities.get(e);
+    if (src.archetype==archetype)
+        return;
+    EntityLocation dst = allocate_row(archetype,e);
+    if (src.archetype!=UINT32_MAX) {
+        Archetype &from = *_archetypes[src.archetype];
+        Archetype &to   = *_archetypes[archetype];
+        for (auto comp: from.components) {
+            void *p = from.component(src.chunk,src.row,comp);
+            if (to.offsets[comp]!=UINT32_MAX)
+                component_info(comp).relocate(to.component(dst.chunk,dst.row,comp),p);
+            else
+                component_info(comp).destroy(p);
+        }
+        free_row(src);
+    }
+    _entities.get(e) = dst;
+}
+
+uint32_t World::get_archetype(Signature signature) {
+    auto it = _archetype_lookup.find(signature);
+    if (it!=_archetype_lookup.end())
+        return it->second;
+    std::unique_ptr<Archetype> arch(new Archetype());
+    arch->signature = signature;
+    for (uint32_t comp=0; comp<max_components; comp++) {
+        arch->offsets[comp] = UINT32_MAX;
+        arch->add_edges[comp] = UINT32_MAX;
+        arch->remove_edges[comp] = UINT32_MAX;
+        if (signature & bit(comp))
+            arch->components.push_back(comp);
+    }
+    // find the largest number of entities that fits in a chunk
+    uint32_t row_size = sizeof(ID);
+    for (auto comp: arch->components)
+        row_size += component_info(comp).size;
+    auto layout = [&](uint32_t capacity) {
+        uint32_t offset = capacity*sizeof(ID);
+        for (auto comp: arch->components) {
+            offset = align_up(offset,component_info(comp).align);
+            arch->offsets[comp] = offset;
+            offset += capacity*component_info(comp).size;
+        }
+        return offset;
+    };
+    uint32_t capacity = std::max(chunk_size/row_size,1u);
+    while (capacity>1 && layout(capacity)>chunk_size)
+        capacity--;
+    arch->capacity    = capacity;
+    arch->chunk_bytes = std::max(layout(capacity),chunk_size);
+    // register the new archetype in the matching queries
+    uint32_t idx = _archetypes.size();
+    for (auto &q: _queries)
+        if ((signature & q.first)==q.first)
+            q.second->archetypes.push_back(idx);
+    _archetypes.push_back(std::move(arch));
+    _archetype_lookup[signature] = idx;
+    return idx;
+}
+
+uint32_t World::get_edge(uint32_t archetype, uint32_t comp, bool add) {
+    uint32_t *edges = add ? _archetypes[archetype]->add_edges : _archetypes[archetype]->remove_edges;
+    if (edges[comp]==UINT32_MAX) {
+        Signature signature = _archetypes[archetype]->signature;
+        // get_archetype can reallocate the archetype list, but not the archetypes
+        edges[comp] = get_archetype(add ? signature | bit(comp) : signature & ~bit(comp));
+    }
+    return edges[comp];
+}
+
+QueryCache& World::get_query_cache(Signature signature) {
+    auto &cache = _queries[signature];
+    if (!cache) {
+        cache.reset(new QueryCache());
+        cache->signature = signature;
+        for (uint32_t i=0; i<_archetypes.size(); i++)
+            if ((_archetypes[i]->signature & signature)==signature)
+                cache->archetypes.push_back(i);
+    }
+    return *cache;
+}
+
+EntityLocation World::allocate_row(uint32_t archetype, ID e) {
+    Archetype &arch = *_archetypes[archetype];
+    if (arch.chunks.empty() || arch.chunks.back().count==arch.capacity) {
+        Chunk chunk;
+        chunk.block = new char[arch.chunk_bytes+CACHE_LINE_SIZE];
+        chunk.data  = chunk.block + (CACHE_LINE_SIZE - reinterpret_cast<uintptr_t>(chunk.block)%CACHE_LINE_SIZE)%CACHE_LINE_SIZE;
+        arch.chunks.push_back(chunk);
+    }
+    EntityLocation loc;
+    loc.archetype = archetype;
+    loc.chunk     = arch.chunks.size()-1;
+    loc.row       = arch.chunks.back().count++;
+    arch.ids(loc.chunk)[loc.row] = e;
+    arch.size++;
+    return loc;
+}
+
+void World::free_row(const EntityLocation &loc) {
+    Archetype &arch = *_archetypes[loc.archetype];
+    uint32_t last_chunk = arch.chunks.size()-1;
+    uint32_t last_row   = arch.chunks[last_chunk].count-1;
+    // fill the hole with the last entity of the archetype
+    if (loc.chunk!=last_chunk || loc.row!=last_row) {
+        for (auto comp: arch.components)
+            component_info(comp).relocate(arch.component(loc.chunk,loc.row,comp),arch.component(last_chunk,last_row,comp));
+        ID moved = arch.ids(last_chunk)[last_row];
+        arch.ids(loc.chunk)[loc.row] = moved;
+        _entities.get(moved) = loc;
+    }
+    arch.size--;
+    if (--arch.chunks[last_chunk].count==0) {
+        delete [] arch.chunks[last_chunk].block;
+        arch.chunks.pop_back();
+    }
+}
+
+
+// CommandBuffer implementation
+
+ID CommandBuffer::create() {
+    ID e = _world.reserve();
+    _commands.push_back(Command {CommandType::CREATE,0,e,nullptr});
+    return e;
+}
+
+void CommandBuffer::destroy(ID e) {
+    _commands.push_back(Command {CommandType::DESTROY,0,e,nullptr});
+}
+
+void CommandBuffer::apply() {
+    size_t i = 0;
+    while (i<_commands.size()) {
+        ID e = _commands[i].entity;
+        if (_commands[i].type==CommandType::DESTROY) {
+            _world.destroy(e);
+            i++;
+            continue;
+        }
+        // merge the run of create/add/remove commands on the same entity
+        Command *values[max_components] = {};
+        Signature touched = 0;
+        Signature current = 0;
+        bool placed = false;
+        if (_world.alive(e)) {
+            uint32_t archetype = _world._entities.get(e).archetype;
+            placed  = archetype!=UINT32_MAX;
+            current = placed ? _world._archetypes[archetype]->signature : 0;
+        }
+        Signature target = current;
+        for (; i<_commands.size() && _commands[i].entity.index==e.index
+               && _commands[i].entity.internal_id==e.internal_id
+               && _commands[i].type!=CommandType::DESTROY; i++) {
+            Command &cmd = _commands[i];
+            if (cmd.type==CommandType::ADD) {
+                target |= bit(cmd.component);
+                values[cmd.component] = &cmd;
+                touched |= bit(cmd.component);
+            } else if (cmd.type==CommandType::REMOVE) {
+                target &= ~bit(cmd.component);
+                values[cmd.component] = nullptr;
+            }
+        }
+        if (!_world.alive(e))
+            continue;
+        if (!placed || target!=current)
+            _world.move_entity(e,target);
+        for (uint32_t comp=0; touched!=0; comp++, touched>>=1) {
+            if (!(touched & 1) || !values[comp])
+                continue;
+            void *dst = _world.get_component(e,comp);
+            if (current & bit(comp))
+                component_info(comp).destroy(dst); // replace the previous value
+            component_info(comp).relocate(dst,values[comp]->value);
+            values[comp]->value = nullptr;
+        }
+    }
+    reset();
+}
+
+void CommandBuffer::clear() {
+    // entities created by the buffer have never been placed: release their ids
+    for (auto &cmd: _commands)
+        if (cmd.type==CommandType::CREATE)
+            _world.destroy(cmd.entity);
+    reset();
+}
+
+void CommandBuffer::reset() {
+    for (auto &cmd: _commands)
+        if (cmd.type==CommandType::ADD && cmd.value)
+            component_info(cmd.component).destroy(cmd.value);
+    _commands.clear();
+    for (auto b: _blocks)
+        delete [] b;
+    _blocks.clear();
+    _block_size = 0;
+    _block_used = 0;
+}
+
+void* CommandBuffer::allocate(uint32_t size, uint32_t align) {
+    uintptr_t base = _blocks.empty() ? 0 : reinterpret_cast<uintptr_t>(_blocks.back());
+    uintptr_t p    = (base+_block_used+align-1)/align*align;
+    if (_blocks.empty() || p+size>base+_block_size) {
+        _block_size = std::max(chunk_size,size+align);
+        _blocks.push_back(new char[_block_size]);
+        base = reinterpret_cast<uintptr_t>(_blocks.back());
+        p    = (base+align-1)/align*align;
+    }
+    _block_used = p+size-base;
+    return reinterpret_cast<void*>(p);
+}
+
+} // namespace ecs
@@ -0,0 +1,353 @@
+#pragma once
+
+#include "common/foundation_types.h"
+#include "common/idtable.h"
+
+#include <cstdint>
+#include <new>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <unordered_map>
+
+/// \namespace ecs
+/// \brief archetype based entity-component store
+/// \details entities are identified by an ID (same scheme of the IDTable) and grouped by the set of their
+/// components (archetype). Each archetype stores its entities in fixed size chunks, with one contiguous
+/// array per component (SoA), so that queries iterate linearly the chunks of the matching archetypes.\n
+/// Structural changes (create/destroy entities, add/remove components) invalidate the iteration of
+/// queries; during an iteration they must be recorded in a CommandBuffer and applied afterwards.
+namespace ecs {
+
+/// bitmask of the components of an archetype
+typedef uint64_t Signature;
+
+/// maximum number of component types
+static const uint32_t max_components = 64;
+/// size of the chunks used to store the entities, in bytes
+static const uint32_t chunk_size = 16*1024;
+
+/// \struct ComponentInfo
+/// \brief type-erased description of a component type
+struct ComponentInfo {
+    uint32_t size;
+    uint32_t align;
+    void (*relocate)(void *dst, void *src); ///< move-construct dst from src and destroy src
+    void (*destroy)(void *p);
+};
+
+/// register a new component type
+/// \return the component id
+uint32_t register_component(const ComponentInfo &info);
+/// get the description of a registered component type
+const ComponentInfo& component_info(uint32_t component);
+
+/// id of the given component type. The type is registered at the first call.
+template <typename T>
+uint32_t component_id();
+
+/// signature containing the given component types
+template <typename... Cs>
+Signature signature_of();
+
+
+/// \struct Chunk
+/// \brief block of memory containing the entity ids and the component arrays of an archetype
+struct Chunk {
+    char     *data  = nullptr; ///< cache line aligned storage
+    char     *block = nullptr; ///< allocated block
+    uint32_t  count = 0;       ///< number of entities stored
+};
+
+/// \struct Archetype
+/// \brief storage for all the entities with the same set of components
+struct Archetype {
+    Signature             signature;
+    std::vector<uint32_t> components;                  ///< component ids, in ascending order
+    uint32_t              offsets[max_components];     ///< offset of the component arrays in the chunks (UINT32_MAX if missing)
+    uint32_t              add_edges[max_components];   ///< archetype reached adding a component (lazily filled)
+    uint32_t              remove_edges[max_components];///< archetype reached removing a component (lazily filled)
+    uint32_t              capacity;                    ///< number of entities per chunk
+    uint32_t              chunk_bytes;                 ///< size of the chunks
+    uint32_t              size = 0;                    ///< number of entities stored
+    std::vector<Chunk>    chunks;                      ///< all the chunks are full, except the last one
+
+    ID* ids(uint32_t chunk) {  return reinterpret_cast<ID*>(chunks[chunk].data);  }
+    void* component(uint32_t chunk, uint32_t row, uint32_t comp) {
+        return chunks[chunk].data + offsets[comp] + row*component_info(comp).size;
+    }
+    template <typename T>
+    T* column(uint32_t chunk) {  return reinterpret_cast<T*>(chunks[chunk].data + offsets[component_id<T>()]);  }
+};
+
+/// \struct EntityLocation
+/// \brief position of an entity in the archetype storage
+struct EntityLocation {
+    uint32_t archetype = UINT32_MAX; ///< UINT32_MAX if the entity has been reserved but not placed yet
+    uint32_t chunk     = 0;
+    uint32_t row       = 0;
+};
+
+/// \struct QueryCache
+/// \brief list of the archetypes matching a signature, updated when new archetypes are created
+struct QueryCache {
+    Signature             signature;
+    std::vector<uint32_t> archetypes;
+};
+
+template <typename... Cs>
+class Query;
+
+
+/// \class World
+/// \brief container of entities and their components
+class World {
+public:
+    World();
+    World(const World&) = delete;
+    ~World();
+
+    /// create an entity without components
+    ID create();
+    /// destroy an entity and all its components; return false if the entity does not exist
+    bool destroy(ID e);
+    /// check if an entity exists
+    bool alive(ID e) const {  return _entities.has(e);  }
+    /// number of entities
+    uint32_t size() const {  return _entities.size();  }
+
+    /// add a component to an entity, or replace its value if already present
+    /// \return the stored component, nullptr if the entity does not exist
+    template <typename T>
+    T* add(ID e, const T &component=T());
+    /// remove a component from an entity; return false if the entity or the component do not exist
+    template <typename T>
+    bool remove(ID e) {  return remove_component(e,component_id<T>());  }
+    /// get a component of an entity; nullptr if the entity does not exist or does not have the component
+    template <typename T>
+    T* get(ID e) {  return static_cast<T*>(get_component(e,component_id<T>()));  }
+    /// check if an entity has a component
+    template <typename T>
+    bool has(ID e) {  return get_component(e,component_id<T>())!=nullptr;  }
+
+    /// get the cached query for the entities with all the given components
+    template <typename... Cs>
+    Query<Cs...> query() {  return Query<Cs...>(this,&get_query_cache(signature_of<Cs...>()));  }
+
+    /// reserve an entity id, without placing the entity in the storage (used by the command buffers)
+    ID reserve();
+    /// move an entity to the archetype with the given signature.
+    /// \details components in both archetypes are preserved, the others are destroyed; the storage of the
+    /// new components is left uninitialized. Reserved entities are placed in the storage.
+    void move_entity(ID e, Signature target);
+    /// storage of a component of an entity; nullptr if missing
+    void* get_component(ID e, uint32_t comp);
+    /// add a missing component to an entity
+    /// \return the uninitialized storage of the new component
+    void* add_component(ID e, uint32_t comp);
+    /// remove a component from an entity
+    bool remove_component(ID e, uint32_t comp);
+
+    std::vector<std::unique_ptr<Archetype>>                    _archetypes;
+    std::unordered_map<Signature,uint32_t>                     _archetype_lookup;
+    std::unordered_map<Signature,std::unique_ptr<QueryCache>>  _queries;
+    IDTable<EntityLocation>                                    _entities;
+
+private:
+    /// get the archetype with the given signature, creating it if needed
+    uint32_t get_archetype(Signature signature);
+    /// archetype reached adding (or removing) a component to the given archetype
+    uint32_t get_edge(uint32_t archetype, uint32_t comp, bool add);
+    QueryCache& get_query_cache(Signature signature);
+    /// move an entity to the given archetype
+    void move_entity_to(ID e, uint32_t archetype);
+    /// append an entity to an archetype
+    EntityLocation allocate_row(uint32_t archetype, ID e);
+    /// remove a row from an archetype, filling the hole with the last entity
+    void free_row(const EntityLocation &loc);
+};
+
+
+/// \class Query
+/// \brief iteration over all the entities having the given components
+/// \details the matching archetypes are cached in the World and kept up to date, so a query only
+/// visits the chunks that contain the requested components.
+template <typename... Cs>
+class Query {
+public:
+    Query(World *world, QueryCache *cache)
+    : _world(world), _cache(cache) {}
+
+    /// call fn(Cs&...) for every matching entity
+    template <typename F>
+    void each(F fn);
+    /// call fn(ID, Cs&...) for every matching entity
+    template <typename F>
+    void each_entity(F fn);
+    /// call fn(count, ids, Cs*...) for every non empty chunk of the matching archetypes
+    template <typename F>
+    void each_chunk(F fn);
+    /// number of matching entities
+    uint32_t count() const;
+
+private:
+    World      *_world;
+    QueryCache *_cache;
+};
+
+
+/// \class CommandBuffer
+/// \brief deferred structural changes of a World
+/// \details the commands are applied in order by apply(). Consecutive add/remove commands on the same entity
+/// are merged, so the entity is moved only once to its final archetype.
+class CommandBuffer {
+public:
+    explicit CommandBuffer(World &world)
+    : _world(world) {}
+    CommandBuffer(const CommandBuffer&) = delete;
+    ~CommandBuffer() {  clear();  }
+
+    /// create an entity. The id is valid immediately, the entity is placed in the storage on apply()
+    ID create();
+    /// destroy an entity
+    void destroy(ID e);
+    /// add a component to an entity
+    template <typename T>
+    void add(ID e, const T &component=T());
+    /// remove a component from an entity
+    template <typename T>
+    void remove(ID e);
+    /// apply all the recorded commands and clear the buffer
+    void apply();
+    /// discard all the recorded commands
+    void clear();
+    /// number of recorded commands
+    size_t size() const {  return _commands.size();  }
+
+private:
+    enum class CommandType : uint8_t {  CREATE, DESTROY, ADD, REMOVE  };
+    struct Command {
+        CommandType type;
+        uint32_t    component;
+        ID          entity;
+        void       *value;    ///< component value for ADD commands
+    };
+
+    /// allocate aligned storage for a component value; the storage is stable until reset()
+    void* allocate(uint32_t size, uint32_t align);
+    /// destroy the values not consumed by apply() and release all the commands
+    void reset();
+
+    World                  &_world;
+    std::vector<Command>    _commands;
+    std::vector<char*>      _blocks;          ///< storage for the component values
+    uint32_t                _block_size = 0;  ///< size of the last block
+    uint32_t                _block_used = 0;  ///< bytes used in the last block
+};
+
+
+
+// template functions implementation
+
+namespace detail {
+    template <typename T>
+    void relocate(void *dst, void *src) {
+        T *s = static_cast<T*>(src);
+        ::new(dst) T(std::move(*s));
+        s->~T();
+    }
+    template <typename T>
+    void destroy(void *p) {
+        static_cast<T*>(p)->~T();
+    }
+    inline Signature signature_or() {  return 0;  }
+    template <typename... Sigs>
+    Signature signature_or(Signature s, Sigs... others) {  return s | signature_or(others...);  }
+
+    template <typename F, typename... Ptrs>
+    void run_rows(F &fn, uint32_t count, Ptrs... columns) {
+        for (uint32_t i=0; i<count; i++)
+            fn(columns[i]...);
+    }
+    template <typename F, typename... Ptrs>
+    void run_entity_rows(F &fn, uint32_t count, const ID *ids, Ptrs... columns) {
+        for (uint32_t i=0; i<count; i++)
+            fn(ids[i],columns[i]...);
+    }
+}
+
+template <typename T>
+uint32_t component_id() {
+    static const uint32_t id = register_component(ComponentInfo {
+            sizeof(T), alignof(T), &detail::relocate<T>, &detail::destroy<T> });
+    return id;
+}
+
+template <typename... Cs>
+Signature signature_of() {
+    return detail::signature_or((Signature(1) << component_id<Cs>())...);
+}
+
+template <typename T>
+T* World::add(ID e, const T &component) {
+    if (!alive(e))
+        return nullptr;
+    uint32_t comp = component_id<T>();
+    if (T *p = static_cast<T*>(get_component(e,comp))) {
+        *p = component;
+        return p;
+    }
+    return ::new(add_component(e,comp)) T(component);
+}
+
+template <typename... Cs>
+template <typename F>
+void Query<Cs...>::each(F fn) {
+    for (auto a: _cache->archetypes) {
+        Archetype &arch = *_world->_archetypes[a];
+        for (uint32_t c=0; c<arch.chunks.size(); c++)
+            detail::run_rows(fn,arch.chunks[c].count,arch.template column<Cs>(c)...);
+    }
+}
+
+template <typename... Cs>
+template <typename F>
+void Query<Cs...>::each_entity(F fn) {
+    for (auto a: _cache->archetypes) {
+        Archetype &arch = *_world->_archetypes[a];
+        for (uint32_t c=0; c<arch.chunks.size(); c++)
+            detail::run_entity_rows(fn,arch.chunks[c].count,arch.ids(c),arch.template column<Cs>(c)...);
+    }
+}
+
+template <typename... Cs>
+template <typename F>
+void Query<Cs...>::each_chunk(F fn) {
+    for (auto a: _cache->archetypes) {
+        Archetype &arch = *_world->_archetypes[a];
+        for (uint32_t c=0; c<arch.chunks.size(); c++)
+            if (arch.chunks[c].count>0)
+                fn(arch.chunks[c].count,arch.ids(c),arch.template column<Cs>(c)...);
+    }
+}
+
+template <typename... Cs>
+uint32_t Query<Cs...>::count() const {
+    uint32_t n = 0;
+    for (auto a: _cache->archetypes)
+        n += _world->_archetypes[a]->size;
+    return n;
+}
+
+template <typename T>
+void CommandBuffer::add(ID e, const T &component) {
+    void *value = ::new(allocate(sizeof(T),alignof(T))) T(component);
+    _commands.push_back(Command {CommandType::ADD,component_id<T>(),e,value});
+}
+
+template <typename T>
+void CommandBuffer::remove(ID e) {
+    _commands.push_back(Command {CommandType::REMOVE,component_id<T>(),e,nullptr});
+}
+
+} // namespace ecs
@@ -0,0 +1,188 @@
+// minimal benchmark harness: warmup, repetitions, robust statistics and JSON/CSV reports
+#pragma once
+
+#include "common/format.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+/// \struct BenchmarkConfig
+/// \brief parameters shared by all the benchmarks of a run
+struct BenchmarkConfig {
+    uint64_t    min_size    = 100;     ///< smallest number of elements in the size sweep
+    uint64_t    max_size    = 1000000; ///< largest number of elements in the size sweep
+    unsigned    warmup      = 1;       ///< discarded runs before the measured ones
+    unsigned    repetitions = 5;       ///< measured runs
+    std::string json_file;             ///< if not empty, write the results in JSON format
+    std::string csv_file;              ///< if not empty, write the results in CSV format
+
+    /// parse --min-size, --max-size, --warmup, --reps, --json and --csv from the command line.
+    /// \return false if the arguments are not valid
+    bool parse(int argc, char *argv[]);
+    /// print the options accepted by parse() on stderr
+    static void usage(const char *argv0);
+    /// sizes of the sweep: powers of 10 between min_size and max_size
+    std::vector<uint64_t> sizes() const;
+};
+
+/// \struct BenchmarkResult
+/// \brief statistics of the measured runs of a scenario
+struct BenchmarkResult {
+    std::string container;
+    std::string scenario;
+    uint64_t    size;
+    unsigned    repetitions;
+    double      median_ns; ///< median of the run times
+    double      mad_ns;    ///< median absolute deviation of the run times
+    double      min_ns;
+
+    double ns_per_element() const {  return size>0 ? median_ns/size : 0;  }
+};
+
+
+/// \class BenchmarkRunner
+/// \brief run the scenarios and collect their statistics
+class BenchmarkRunner {
+public:
+    explicit BenchmarkRunner(const BenchmarkConfig &config)
+    : _config(config) {}
+
+    /// run a scenario. fn(size) must return the time spent in the measured section, in ns
+    template <typename F>
+    const BenchmarkResult& run(const char *container, const char *scenario, uint64_t size, F fn);
+
+    /// print a summary table on stdout
+    void print() const;
+    /// write the results in the files specified in the configuration
+    bool write() const;
+    bool write_json(const char *path) const;
+    bool write_csv(const char *path) const;
+
+    const std::vector<BenchmarkResult>& results() const {  return _results;  }
+
+private:
+    BenchmarkConfig              _config;
+    std::vector<BenchmarkResult> _results;
+};
+
+/// elapsed time from the given time point, in ns
+inline int64_t elapsed_ns(std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now()-start).count();
+}
+
+/// prevent the compiler from optimizing away a computed value
+template <typename T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+
+
+// implementation
+
+inline bool BenchmarkConfig::parse(int argc, char *argv[]) {
+    for (int i=1; i<argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i+1<argc ? argv[i+1] : nullptr;
+        if (!val)
+            return false;
+        if      (!strcmp(arg,"--min-size")) min_size    = (uint64_t)atof(val);
+        else if (!strcmp(arg,"--max-size")) max_size    = (uint64_t)atof(val);
+        else if (!strcmp(arg,"--warmup"))   warmup      = atoi(val);
+        else if (!strcmp(arg,"--reps"))     repetitions = std::max(atoi(val),1);
+        else if (!strcmp(arg,"--json"))     json_file   = val;
+        else if (!strcmp(arg,"--csv"))      csv_file    = val;
+        else
+            return false;
+        i++;
+    }
+    return min_size>0 && min_size<=max_size;
+}
+
+inline void BenchmarkConfig::usage(const char *argv0) {
+    fprintf(stderr,"usage: %s [--min-size N] [--max-size N] [--warmup N] [--reps N] [--json file] [--csv file]\n",argv0);
+}
+
+inline std::vector<uint64_t> BenchmarkConfig::sizes() const {
+    std::vector<uint64_t> s;
+    for (uint64_t n=min_size; n<=max_size; n*=10)
+        s.push_back(n);
+    return s;
+}
+
+template <typename F>
+const BenchmarkResult& BenchmarkRunner::run(const char *container, const char *scenario, uint64_t size, F fn) {
+    for (unsigned i=0; i<_config.warmup; i++)
+        fn(size);
+    std::vector<double> times;
+    for (unsigned i=0; i<_config.repetitions; i++)
+        times.push_back(fn(size));
+    auto median = [](std::vector<double> v) {
+        std::sort(v.begin(),v.end());
+        return v.size()%2 ? v[v.size()/2] : 0.5*(v[v.size()/2-1]+v[v.size()/2]);
+    };
+    BenchmarkResult res;
+    res.container   = container;
+    res.scenario    = scenario;
+    res.size        = size;
+    res.repetitions = _config.repetitions;
+    res.median_ns   = median(times);
+    res.min_ns      = *std::min_element(times.begin(),times.end());
+    std::vector<double> deviations;
+    for (auto t: times)
+        deviations.push_back(std::fabs(t-res.median_ns));
+    res.mad_ns = median(deviations);
+    _results.push_back(res);
+    return _results.back();
+}
+
+inline void BenchmarkRunner::print() const {
+    fmt::print("\n{:-^96}\n", " Benchmark results ");
+    fmt::print("|{:<22}|{:<12}|{:>12}|{:>14}|{:>14}|{:>14}|\n", "container","scenario","size","median [ns]","mad [ns]","ns/element");
+    for (auto &r: _results)
+        fmt::print("|{:<22}|{:<12}|{:>12}|{:>14.0f}|{:>14.0f}|{:>14.3f}|\n", r.container,r.scenario,r.size,r.median_ns,r.mad_ns,r.ns_per_element());
+    fmt::print("{:-^96}\n", "");
+}
+
+inline bool BenchmarkRunner::write() const {
+    bool ok = true;
+    if (!_config.json_file.empty())
+        ok = write_json(_config.json_file.c_str()) && ok;
+    if (!_config.csv_file.empty())
+        ok = write_csv(_config.csv_file.c_str()) && ok;
+    return ok;
+}
+
+inline bool BenchmarkRunner::write_json(const char *path) const {
+    FILE *fp = fopen(path,"w");
+    if (!fp)
+        return false;
+    fprintf(fp,"{\"warmup\":%u,\"repetitions\":%u,\"results\":[\n",_config.warmup,_config.repetitions);
+    for (size_t i=0; i<_results.size(); i++) {
+        auto &r = _results[i];
+        fprintf(fp,"{\"container\":\"%s\",\"scenario\":\"%s\",\"size\":%llu,\"median_ns\":%.1f,\"mad_ns\":%.1f,\"min_ns\":%.1f}%s\n",
+                r.container.c_str(),r.scenario.c_str(),(unsigned long long)r.size,r.median_ns,r.mad_ns,r.min_ns,
+                i+1<_results.size() ? "," : "");
+    }
+    fprintf(fp,"]}\n");
+    return fclose(fp)==0;
+}
+
+inline bool BenchmarkRunner::write_csv(const char *path) const {
+    FILE *fp = fopen(path,"w");
+    if (!fp)
+        return false;
+    fprintf(fp,"container,scenario,size,repetitions,median_ns,mad_ns,min_ns\n");
+    for (auto &r: _results)
+        fprintf(fp,"%s,%s,%llu,%u,%.1f,%.1f,%.1f\n",r.container.c_str(),r.scenario.c_str(),(unsigned long long)r.size,
+                r.repetitions,r.median_ns,r.mad_ns,r.min_ns);
+    return fclose(fp)==0;
+}
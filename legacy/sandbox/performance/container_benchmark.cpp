@@ -0,0 +1,205 @@
+// benchmark of the containers over a sweep of sizes. Usage:
+// container_benchmark [--min-size N] [--max-size N] [--warmup N] [--reps N] [--json file] [--csv file]
+#include "benchmark.h"
+
+#include "common/idtable.h"
+#include "common/static_idtable.h"
+#include "common/compact_static_idtable.h"
+#include "common/versioned_idtable.h"
+#include "ecs/ecs.h"
+
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+
+struct TestData {
+    int64_t counter;
+    double  value;
+    char    data[10];
+    int64_t timestamp;
+};
+
+// adapters exposing the same interface for all the containers:
+// Handle add(const TestData&), void remove(Handle), const TestData& get(Handle), for_each(fn)
+
+template <typename Map>
+struct MapAdapter {
+    typedef int64_t Handle;
+    static const uint64_t max_size = UINT64_MAX;
+    Map     map;
+    int64_t uuid = 0;
+    Handle add(const TestData &d)            {  map[uuid] = d;  return uuid++;  }
+    void remove(Handle h)                    {  map.erase(h);  }
+    const TestData& get(Handle h)            {  return map.find(h)->second;  }
+    template <typename F> void for_each(F f) {  for (auto &it: map) f(it.second);  }
+};
+
+struct IDTableAdapter {
+    typedef ID Handle;
+    static const uint64_t max_size = UINT32_MAX-1;
+    IDTable<TestData> table;
+    Handle add(const TestData &d)            {  return table.add(d);  }
+    void remove(Handle h)                    {  table.remove(h);  }
+    const TestData& get(Handle h)            {  return table.get(h);  }
+    template <typename F> void for_each(F f) {  for (uint32_t i=0; i<table.size(); i++) f(table._objects[i]);  }
+};
+
+template <unsigned int N>
+struct StaticIDTableAdapter {
+    typedef ID Handle;
+    static const uint64_t max_size = N;
+    std::unique_ptr<StaticIDTable<TestData,N>> table {new StaticIDTable<TestData,N>()};
+    Handle add(const TestData &d)            {  return table->add(d);  }
+    void remove(Handle h)                    {  table->remove(h);  }
+    const TestData& get(Handle h)            {  return table->get(h);  }
+    template <typename F> void for_each(F f) {  for (uint32_t i=0; i<table->size(); i++) f(table->_objects[i]);  }
+};
+
+template <unsigned int N>
+struct CompactStaticIDTableAdapter {
+    typedef CompactID<N> Handle;
+    static const uint64_t max_size = N;
+    std::unique_ptr<CompactStaticIDTable<TestData,N>> table {new CompactStaticIDTable<TestData,N>()};
+    Handle add(const TestData &d)            {  return table->add(d);  }
+    void remove(Handle h)                    {  table->remove(h);  }
+    const TestData& get(Handle h)            {  return table->get(h);  }
+    template <typename F> void for_each(F f) {  for (auto &d: *table) f(d);  }
+};
+
+struct VersionedIDTableAdapter {
+    typedef ID Handle;
+    static const uint64_t max_size = UINT32_MAX-1;
+    VersionedIDTable<TestData> table;
+    Handle add(const TestData &d)            {  return table.add(d);  }
+    void remove(Handle h)                    {  table.remove(h);  }
+    const TestData& get(Handle h)            {  return table.get(h);  }
+    template <typename F> void for_each(F f) {  table.publish();  table.snapshot()->for_each(f);  }
+};
+
+struct ECSAdapter {
+    typedef ID Handle;
+    static const uint64_t max_size = UINT32_MAX-1;
+    ecs::World world;
+    Handle add(const TestData &d)            {  auto e = world.create();  world.add(e,d);  return e;  }
+    void remove(Handle h)                    {  world.destroy(h);  }
+    const TestData& get(Handle h)            {  return *world.get<TestData>(h);  }
+    template <typename F> void for_each(F f) {  world.query<TestData>().each(f);  }
+};
+
+
+// scenarios: each one returns the time spent in the measured section, in ns
+
+const TestData sample {1, 1.0, {0,0,0,0,0,0,0,0,0,0}, 10010101};
+
+template <typename C>
+void fill(C &c, uint64_t n, std::vector<typename C::Handle> &handles) {
+    handles.clear();
+    for (uint64_t i=0; i<n; i++)
+        handles.push_back(c.add(sample));
+}
+
+/// add n elements to an empty container
+template <typename C>
+double scenario_create(uint64_t n) {
+    C c;
+    std::vector<typename C::Handle> handles;
+    handles.reserve(n);
+    auto start = std::chrono::high_resolution_clock::now();
+    fill(c,n,handles);
+    return elapsed_ns(start);
+}
+
+/// replace n/2 random elements, removing and adding them in batches
+template <typename C>
+double scenario_churn(uint64_t n) {
+    C c;
+    std::vector<typename C::Handle> handles;
+    fill(c,n,handles);
+    std::mt19937 rng(0);
+    std::vector<bool> removed(n,false);
+    std::vector<uint64_t> candidates;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto k=0; k<10; k++) {
+        candidates.clear();
+        for (uint64_t i=0; i<std::max<uint64_t>(n/20,1); i++) {
+            auto idx = rng()%n;
+            if (!removed[idx]) {
+                c.remove(handles[idx]);
+                removed[idx] = true;
+                candidates.push_back(idx);
+            }
+        }
+        for (auto idx: candidates) {
+            handles[idx] = c.add(sample);
+            removed[idx] = false;
+        }
+    }
+    return elapsed_ns(start);
+}
+
+/// access all the elements by handle, in random order
+template <typename C>
+double scenario_lookup(uint64_t n) {
+    C c;
+    std::vector<typename C::Handle> handles;
+    fill(c,n,handles);
+    std::shuffle(handles.begin(),handles.end(),std::mt19937(0));
+    int64_t sum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto h: handles)
+        sum += c.get(h).counter;
+    double t = elapsed_ns(start);
+    do_not_optimize(sum);
+    return t;
+}
+
+/// iterate over all the elements
+template <typename C>
+double scenario_iterate(uint64_t n) {
+    C c;
+    std::vector<typename C::Handle> handles;
+    fill(c,n,handles);
+    int64_t sum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    c.for_each([&](const TestData &d) {  sum += d.counter;  });
+    double t = elapsed_ns(start);
+    do_not_optimize(sum);
+    return t;
+}
+
+template <typename C>
+void run_container(BenchmarkRunner &runner, const char *name, const std::vector<uint64_t> &sizes) {
+    for (auto n: sizes) {
+        if (n>C::max_size)
+            break;
+        runner.run(name,"create", n,scenario_create<C>);
+        runner.run(name,"churn",  n,scenario_churn<C>);
+        runner.run(name,"lookup", n,scenario_lookup<C>);
+        runner.run(name,"iterate",n,scenario_iterate<C>);
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    BenchmarkConfig config;
+    if (!config.parse(argc,argv)) {
+        BenchmarkConfig::usage(argv[0]);
+        return 1;
+    }
+    BenchmarkRunner runner(config);
+    auto sizes = config.sizes();
+    run_container<MapAdapter<std::map<int64_t,TestData>>>          (runner,"std::map",            sizes);
+    run_container<MapAdapter<std::unordered_map<int64_t,TestData>>>(runner,"std::unordered_map",  sizes);
+    run_container<IDTableAdapter>                                  (runner,"IDTable",             sizes);
+    run_container<StaticIDTableAdapter<10000>>                     (runner,"StaticIDTable",       sizes);
+    run_container<CompactStaticIDTableAdapter<10000>>              (runner,"CompactStaticIDTable",sizes);
+    run_container<VersionedIDTableAdapter>                         (runner,"VersionedIDTable",    sizes);
+    run_container<ECSAdapter>                                      (runner,"ecs::World",          sizes);
+    runner.print();
+    return runner.write() ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 // example taken from https://github.com/hrydgard/minitrace
 #include "common/idtable.h"
 #include "common/static_idtable.h"
+#include "common/compact_static_idtable.h"
 #include "common/format.h"
 #include "tracing/tracing.h"
 
@@ -198,6 +199,61 @@ PerfResults performance_static_idtable(unsigned int N) {
 }
 
 
+PerfResults performance_compact_static_idtable(unsigned int N) {
+    std::vector<CompactID<100>> ids;
+    CompactStaticIDTable<TestData,100> mytable;
+    srand(0);
+    // creation
+    auto tp_creation_start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i=0; i<N; i++) {
+        auto id = mytable.add(TestData { .counter=i, .value=0.0, .data={0,0,0,0,0,0,0,0,0,0}, .timestamp=10010101 });
+        ids.push_back(id);
+    }
+    auto tp_creation_end = std::chrono::high_resolution_clock::now();
+    // replace N/2 elements by removing and adding batches
+    auto tp_replace_start = std::chrono::high_resolution_clock::now();
+    const int num_batches = 10;
+    for (auto k=0; k<num_batches; k++) {
+        auto n_elem = N/2/num_batches;
+        std::vector<int> candidates(n_elem);
+        // remove
+        for (auto&& c: candidates) {
+            c = rand() % N;
+            mytable.remove(ids[c]);
+            ids[c] = CompactID<100>();
+        }
+        // add
+        for (auto c: candidates) {
+            auto id = mytable.add(TestData { .counter=100, .value=1.0, .data={0,0,0,0,0,0,0,0,0,0}, .timestamp=20020202 });
+            ids.push_back(id);
+        }
+    }
+    auto tp_replace_end = std::chrono::high_resolution_clock::now();
+    auto tp_replace = std::chrono::high_resolution_clock::now();
+    // increase counter accessing by id
+    auto tp_increase_id_start = std::chrono::high_resolution_clock::now();
+    for (auto id: ids) {
+        // if(mytable.has(id))
+        if (valid(id))
+            mytable.get(id).counter += 1;
+    }
+    auto tp_increase_id_end = std::chrono::high_resolution_clock::now();
+    // increase counter accessing by iterator
+    auto tp_increase_iter_start = std::chrono::high_resolution_clock::now();
+    for (auto i=0; i<mytable.size(); i++) {
+        mytable.data()[i].counter +=1;
+    }
+    auto tp_increase_iter_end = std::chrono::high_resolution_clock::now();
+    // summary
+    return PerfResults {
+              .creation       = std::chrono::duration_cast<std::chrono::nanoseconds>(tp_creation_end-tp_creation_start).count(),
+              .replace        = std::chrono::duration_cast<std::chrono::nanoseconds>(tp_replace_end-tp_replace_start).count(),
+              .access_by_id   = std::chrono::duration_cast<std::chrono::nanoseconds>(tp_increase_id_end-tp_increase_id_start).count(),
+              .access_by_iter = std::chrono::duration_cast<std::chrono::nanoseconds>(tp_increase_iter_end-tp_increase_iter_start).count()
+    };
+}
+
+
 // test the idtable performance on the following scenario:
 // 1) create N objects
 // 2) replace N/2 random objects
@@ -239,11 +295,13 @@ int main(int argc, char *argv[]) {
     std::cout << std::endl << "testing IDTable and StaticIDTable with " << Nstatic << " elements" << std::endl;
     PerfResults dyn_idtable_res    = performance_idtable(Nstatic);
     PerfResults static_idtable_res = performance_static_idtable(Nstatic);
+    PerfResults compact_idtable_res = performance_compact_static_idtable(Nstatic);
 
     fmt::print("\n{:-^72}\n", " IDTable perf comparison ");
     fmt::print("|{:>10}|{:>14}|{:>14}|{:>14}|{:>14}|\n", "","creation", "replace", "access_by_id", "access_by_iter");
     fmt::print("|{:<10}|{:>14}|{:>14}|{:>14}|{:>14}|\n", "Dynamic",dyn_idtable_res.creation, dyn_idtable_res.replace, dyn_idtable_res.access_by_id, dyn_idtable_res.access_by_iter);
     fmt::print("|{:<10}|{:>14}|{:>14}|{:>14}|{:>14}|\n", "Static",static_idtable_res.creation, static_idtable_res.replace, static_idtable_res.access_by_id, static_idtable_res.access_by_iter);
+    fmt::print("|{:<10}|{:>14}|{:>14}|{:>14}|{:>14}|\n", "Compact",compact_idtable_res.creation, compact_idtable_res.replace, compact_idtable_res.access_by_id, compact_idtable_res.access_by_iter);
     fmt::print("{:-^72}\n", "");
     fmt::print("|{:<10}|{:>14}|{:>14}|{:>14}|{:>14}|\n", "ratio",(float)dyn_idtable_res.creation/static_idtable_res.creation,
                                                                 (float)dyn_idtable_res.replace/static_idtable_res.replace,
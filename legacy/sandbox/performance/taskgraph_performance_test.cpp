@@ -0,0 +1,90 @@
+// makespan of synthetic task graphs with the FIFO and the CRITICAL_PATH policies. Usage:
+// taskgraph_performance_test [--min-size N] [--max-size N] [--warmup N] [--reps N] [--json file] [--csv file]
+// the size is the number of nodes of the graphs
+#include "benchmark.h"
+
+#include "threadpool/task_graph.h"
+
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+// busy work for the given time
+void spin_for(int64_t ns) {
+    auto start = std::chrono::high_resolution_clock::now();
+    while (elapsed_ns(start)<ns)
+        ;
+}
+
+// a long chain of heavy nodes, declared after many independent light nodes
+void build_chain_and_fan(TaskGraph &graph, uint64_t size, unsigned num_workers) {
+    uint32_t chain_len = std::max<uint64_t>(size/(4*num_workers),2);
+    for (uint32_t i=0; i<size-chain_len; i++)
+        graph.add_node([]{  spin_for(20000);  });
+    uint32_t prev = UINT32_MAX;
+    for (uint32_t i=0; i<chain_len; i++) {
+        auto n = graph.add_node([]{  spin_for(20000);  });
+        if (prev!=UINT32_MAX)
+            graph.add_edge(prev,n);
+        prev = n;
+    }
+}
+
+// random layered graph with random durations
+void build_random_layers(TaskGraph &graph, uint64_t size, unsigned num_workers) {
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int64_t> duration(2000,60000);
+    uint32_t width = 2*num_workers;
+    for (uint32_t i=0; i<size; i++) {
+        int64_t ns = duration(rng);
+        graph.add_node([ns]{  spin_for(ns);  });
+        // each node depends on up to 3 random nodes of the previous layer
+        if (i>=width) {
+            uint32_t layer_start = (i/width-1)*width;
+            for (int k=0; k<3; k++)
+                if (rng()%2)
+                    graph.add_edge(layer_start+rng()%width,i);
+        }
+    }
+}
+
+template <typename Builder>
+void run_graph(BenchmarkRunner &runner, BasicThreadPool &pool, const char *scenario, uint64_t size, Builder build) {
+    const TaskGraphPolicy policies[] = {TaskGraphPolicy::FIFO, TaskGraphPolicy::CRITICAL_PATH};
+    const char *names[] = {"fifo", "critical_path"};
+    for (int p=0; p<2; p++) {
+        TaskGraph graph;
+        build(graph,size,pool.num_workers());
+        graph.set_policy(policies[p]);
+        // the warmup runs also measure the node durations
+        runner.run(names[p],scenario,size,[&](uint64_t) {
+            auto start = std::chrono::high_resolution_clock::now();
+            graph.run(pool);
+            return elapsed_ns(start);
+        });
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkConfig config;
+    config.min_size = 100;
+    config.max_size = 1000;
+    config.warmup = 2;
+    if (!config.parse(argc,argv)) {
+        BenchmarkConfig::usage(argv[0]);
+        return 1;
+    }
+    unsigned num_workers = std::max(std::thread::hardware_concurrency(),2u);
+    ThreadPool pool(num_workers);
+    pool.start();
+    BenchmarkRunner runner(config);
+    for (auto size: config.sizes()) {
+        run_graph(runner,pool,"chain_fan",size,build_chain_and_fan);
+        run_graph(runner,pool,"random",size,build_random_layers);
+    }
+    runner.print();
+    return runner.write() ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+// job submission throughput of the thread pool: one add_job() per job against a single add_jobs() batch. Usage:
+// threadpool_performance_test [--min-size N] [--max-size N] [--warmup N] [--reps N] [--json file] [--csv file]
+// the size is the number of submitted jobs. The "submit" scenario measures the submission only (paused pool),
+// the "complete" scenario measures the time until all the jobs are executed. The "latency" scenario submits one job
+// at a time and polls for its completion, with workers that park immediately or poll before parking.
+#include "benchmark.h"
+
+#include "threadpool/threadpool.h"
+
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+void empty_fun(Job*) {}
+
+// submit the jobs, with one call per job or with a single batch
+void submit(BasicThreadPool &pool, const std::vector<Job> &jobs, bool batch) {
+    if (batch) {
+        pool.add_jobs(jobs.data(),jobs.size());
+        return;
+    }
+    for (auto &job: jobs)
+        pool.add_job(job);
+}
+
+void run_submission(BenchmarkRunner &runner, unsigned num_workers, uint64_t size) {
+    const char *names[] = {"add_job", "add_jobs"};
+    std::vector<Job> jobs(size,Job(empty_fun));
+    for (int b=0; b<2; b++) {
+        runner.run(names[b],"submit",size,[&](uint64_t) {
+            // the workers are paused: only the submission is measured
+            BasicThreadPool pool(num_workers);
+            auto start = std::chrono::high_resolution_clock::now();
+            submit(pool,jobs,b==1);
+            int64_t t = elapsed_ns(start);
+            pool.start();
+            pool.wait();
+            return t;
+        });
+        BasicThreadPool pool(num_workers);
+        pool.start();
+        runner.run(names[b],"complete",size,[&](uint64_t) {
+            auto start = std::chrono::high_resolution_clock::now();
+            submit(pool,jobs,b==1);
+            pool.wait();
+            return elapsed_ns(start);
+        });
+    }
+}
+
+void run_latency(BenchmarkRunner &runner, unsigned num_workers, uint64_t size) {
+    const char *names[] = {"park", "spin_yield_park"};
+    for (int p=0; p<2; p++) {
+        ThreadPoolConfig config(num_workers);
+        if (p==0) {
+            config.idle_spin_us = 0;
+            config.idle_yield_us = 0;
+        }
+        BasicThreadPool pool(config);
+        pool.start();
+        runner.run(names[p],"latency",size,[&](uint64_t n) {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint64_t i=0; i<n; i++) {
+                JobCounter counter;
+                pool.add_job(Job(empty_fun),&counter);
+                while (!counter.done())
+                    std::this_thread::yield();
+                // let the workers go idle again
+                if (i%16==0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(1));
+            }
+            return elapsed_ns(start);
+        });
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkConfig config;
+    config.min_size = 100;
+    config.max_size = 100000;
+    if (!config.parse(argc,argv)) {
+        BenchmarkConfig::usage(argv[0]);
+        return 1;
+    }
+    unsigned num_workers = std::max(std::thread::hardware_concurrency(),2u);
+    BenchmarkRunner runner(config);
+    for (auto size: config.sizes()) {
+        run_submission(runner,num_workers,size);
+        run_latency(runner,num_workers,std::min<uint64_t>(size,10000));
+    }
+    runner.print();
+    return runner.write() ? 0 : 1;
+}
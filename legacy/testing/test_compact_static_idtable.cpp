@@ -0,0 +1,98 @@
+#include <iostream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "common/compact_static_idtable.h"
+#include "common/static_idtable.h"
+
+namespace {
+    // count the live instances, to check that only the added objects are constructed
+    struct Counted {
+        static int instances;
+        int value;
+        Counted(int v=0) : value(v) {  instances++;  }
+        Counted(const Counted &o) : value(o.value) {  instances++;  }
+        Counted& operator=(const Counted &o) = default;
+        ~Counted() {  instances--;  }
+    };
+    int Counted::instances = 0;
+}
+
+TEST(CompactStaticIDTable, Creation) {
+    CompactStaticIDTable<int64_t,16> idtable;
+    ASSERT_EQ(idtable.size(),0);
+    // index and handle types depend on the maximum size
+    ASSERT_EQ(sizeof(CompactStaticIDTable<int64_t,100>::index_type),1);
+    ASSERT_EQ(sizeof(CompactStaticIDTable<int64_t,1000>::index_type),2);
+    ASSERT_EQ(sizeof(CompactStaticIDTable<int64_t,100000>::index_type),4);
+    ASSERT_EQ(sizeof(CompactID<100>),4);
+    ASSERT_EQ(sizeof(CompactID<1000>),4);
+    ASSERT_LT(sizeof(CompactStaticIDTable<int64_t,100>),sizeof(StaticIDTable<int64_t,100>));
+}
+
+TEST(CompactStaticIDTable, Construction) {
+    {
+        CompactStaticIDTable<Counted,100> idtable;
+        ASSERT_EQ(Counted::instances,0);
+        auto id1 = idtable.add(Counted(1));
+        auto id2 = idtable.emplace(2);
+        ASSERT_EQ(Counted::instances,2);
+        idtable.remove(id1);
+        ASSERT_EQ(Counted::instances,1);
+        ASSERT_EQ(idtable.get(id2).value,2);
+        CompactStaticIDTable<Counted,100> copy(idtable);
+        ASSERT_EQ(Counted::instances,2);
+        ASSERT_EQ(copy.get(id2).value,2);
+    }
+    ASSERT_EQ(Counted::instances,0);
+}
+
+TEST(CompactStaticIDTable, Get) {
+    CompactStaticIDTable<std::string,16> idtable;
+    auto id1 = idtable.add("one");
+    auto id2 = idtable.add("two");
+    auto id3 = idtable.add("three");
+    ASSERT_EQ(idtable.size(),3);
+    ASSERT_EQ(idtable.get(id1),"one");
+    ASSERT_EQ(idtable.get(id2),"two");
+    ASSERT_EQ(idtable.get(id3),"three");
+}
+
+TEST(CompactStaticIDTable, Has) {
+    CompactStaticIDTable<int64_t,16> idtable;
+    auto id1 = idtable.add(1);
+    auto id2 = idtable.add(2);
+    ASSERT_TRUE(idtable.has(id1));
+    ASSERT_TRUE(idtable.has(id2));
+    ASSERT_FALSE(idtable.has(CompactID<16>(10,0)));
+    ASSERT_FALSE(idtable.has(CompactID<16>()));
+    ASSERT_FALSE(valid(CompactID<16>()));
+}
+
+TEST(CompactStaticIDTable, Remove) {
+    CompactStaticIDTable<int64_t,16> idtable;
+    auto id1 = idtable.add(1);
+    auto id2 = idtable.add(2);
+    auto id3 = idtable.add(3);
+    ASSERT_TRUE(idtable.remove(id2));
+    ASSERT_FALSE(idtable.remove(id2)); // try to remove an element alredy removed
+    ASSERT_EQ(idtable.size(),2);
+    ASSERT_TRUE(idtable.has(id1));
+    ASSERT_FALSE(idtable.has(id2));
+    ASSERT_TRUE(idtable.has(id3));
+    // the slot is reused, but the stale handle stays invalid
+    auto id4 = idtable.add(4);
+    ASSERT_EQ(id4.index,id2.index);
+    ASSERT_FALSE(idtable.has(id2));
+    ASSERT_TRUE(idtable.has(id4));
+    // check the internal oredering
+    ASSERT_EQ(idtable.data()[0],1);
+    ASSERT_EQ(idtable.data()[1],3);
+    ASSERT_EQ(idtable.data()[2],4);
+    int64_t sum = 0;
+    for (auto v: idtable)
+        sum += v;
+    ASSERT_EQ(sum,8);
+}
+
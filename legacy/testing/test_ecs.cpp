@@ -0,0 +1,133 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "ecs/ecs.h"
+
+namespace {
+    struct Position {
+        float x, y;
+    };
+    struct Velocity {
+        float dx, dy;
+    };
+    struct Name {
+        std::string name;
+    };
+}
+
+TEST(ECS, Creation) {
+    ecs::World world;
+    auto e1 = world.create();
+    auto e2 = world.create();
+    ASSERT_EQ(world.size(),2);
+    ASSERT_TRUE(world.alive(e1));
+    ASSERT_TRUE(world.destroy(e1));
+    ASSERT_FALSE(world.destroy(e1));
+    ASSERT_FALSE(world.alive(e1));
+    ASSERT_TRUE(world.alive(e2));
+    ASSERT_EQ(world.size(),1);
+}
+
+TEST(ECS, Components) {
+    ecs::World world;
+    auto e = world.create();
+    ASSERT_FALSE(world.has<Position>(e));
+    world.add(e,Position {1,2});
+    world.add(e,Name {"pippo"});
+    ASSERT_TRUE(world.has<Position>(e));
+    ASSERT_FALSE(world.has<Velocity>(e));
+    ASSERT_EQ(world.get<Position>(e)->y,2);
+    ASSERT_EQ(world.get<Name>(e)->name,"pippo");
+    // replace an existing component
+    world.add(e,Position {3,4});
+    ASSERT_EQ(world.get<Position>(e)->x,3);
+    // remove moves the entity to another archetype, preserving the other components
+    ASSERT_TRUE(world.remove<Position>(e));
+    ASSERT_FALSE(world.remove<Position>(e));
+    ASSERT_EQ(world.get<Position>(e),nullptr);
+    ASSERT_EQ(world.get<Name>(e)->name,"pippo");
+}
+
+TEST(ECS, Query) {
+    ecs::World world;
+    std::vector<ID> ids;
+    // enough entities to fill several chunks, with different archetypes
+    for (auto i=0; i<10000; i++) {
+        auto e = world.create();
+        world.add(e,Position {float(i),0});
+        if (i%2==0)
+            world.add(e,Velocity {1,2});
+        if (i%3==0)
+            world.add(e,Name {"entity"});
+        ids.push_back(e);
+    }
+    auto moving = world.query<Position,Velocity>();
+    ASSERT_EQ(moving.count(),5000);
+    moving.each([](Position &p, Velocity &v) {
+        p.x += v.dx;
+        p.y += v.dy;
+    });
+    for (auto i=0; i<10000; i++)
+        ASSERT_EQ(world.get<Position>(ids[i])->y,i%2==0 ? 2 : 0);
+    // the cached query sees the archetypes created afterwards
+    auto named = world.query<Name>();
+    ASSERT_EQ(named.count(),3334);
+    struct Tag {};
+    world.add(ids[0],Tag());
+    ASSERT_EQ(moving.count(),5000);
+    ASSERT_EQ((world.query<Velocity,Tag>().count()),1);
+    // destroying entities keeps the chunks packed
+    for (auto i=0; i<10000; i+=4)
+        world.destroy(ids[i]);
+    uint32_t count = 0;
+    moving.each_entity([&](ID e, Position &p, Velocity&) {
+        ASSERT_TRUE(world.alive(e));
+        ASSERT_EQ(p.x,e.index+1);
+        count++;
+    });
+    ASSERT_EQ(count,2500);
+    count = 0;
+    moving.each_chunk([&](uint32_t n, const ID*, Position*, Velocity*) {  count += n;  });
+    ASSERT_EQ(count,2500);
+}
+
+TEST(ECS, CommandBuffer) {
+    ecs::World world;
+    std::vector<ID> ids;
+    for (auto i=0; i<100; i++) {
+        auto e = world.create();
+        world.add(e,Position {float(i),0});
+        ids.push_back(e);
+    }
+    // record structural changes during the iteration, and apply them afterwards
+    ecs::CommandBuffer cmd(world);
+    world.query<Position>().each_entity([&](ID e, Position &p) {
+        if (int(p.x)%2==0)
+            cmd.add(e,Velocity {1,1});
+        else
+            cmd.destroy(e);
+        if (int(p.x)%10==0) {
+            auto child = cmd.create();
+            cmd.add(child,Position {-1,-1});
+            cmd.add(child,Name {"child"});
+            cmd.remove<Position>(child);
+        }
+    });
+    ASSERT_EQ(world.query<Velocity>().count(),0);
+    cmd.apply();
+    ASSERT_EQ(cmd.size(),0);
+    ASSERT_EQ((world.query<Position,Velocity>().count()),50);
+    ASSERT_EQ(world.query<Name>().count(),10);
+    ASSERT_EQ((world.query<Position,Name>().count()),0);
+    ASSERT_EQ(world.size(),60);
+    // discarded buffers release the reserved entities
+    auto e = cmd.create();
+    cmd.add(e,Name {"discarded"});
+    cmd.clear();
+    ASSERT_FALSE(world.alive(e));
+    ASSERT_EQ(world.size(),60);
+}
+
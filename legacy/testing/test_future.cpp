@@ -0,0 +1,120 @@
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "threadpool/future.h"
+
+TEST(Future, Submit) {
+    BasicThreadPool pool(2);
+    pool.start();
+    auto f = submit(pool,[]{ return 6*7; });
+    ASSERT_TRUE(f.valid());
+    ASSERT_EQ(f.get(),42);
+    ASSERT_FALSE(f.valid());
+    // results that are not trivially copyable
+    auto s = submit(pool,[]{ return std::string(100,'x'); });
+    ASSERT_EQ(s.get().size(),100u);
+    auto p = submit(pool,[]{ return std::unique_ptr<int>(new int(3)); });
+    ASSERT_EQ(*p.get(),3);
+    // void results
+    std::atomic<int32_t> counter(0);
+    auto v = submit(pool,[&counter]{ counter++; });
+    v.get();
+    ASSERT_EQ(counter,1);
+    // exceptions are rethrown by get()
+    auto e = submit(pool,[]() -> int { throw std::runtime_error("job failure"); });
+    ASSERT_THROW(e.get(),std::runtime_error);
+    // a future dropped before completion
+    submit(pool,[]{ return std::string(100,'y'); });
+    pool.wait();
+}
+
+TEST(Future, Then) {
+    ThreadPool pool(2);
+    pool.start();
+    auto f = submit(pool,[]{ return 2; })
+            .then([](int v){ return v*10; })
+            .then([](int v){ return std::to_string(v); });
+    ASSERT_EQ(f.get(),"20");
+    // continuation of a future already complete
+    auto ready = submit(pool,[]{ return 1; });
+    ready.wait();
+    ASSERT_TRUE(ready.ready());
+    Future<int> next = ready.then([](int v){ return v+1; });
+    ASSERT_EQ(next.get(),2);
+    // void futures and continuations
+    std::atomic<int32_t> counter(0);
+    submit(pool,[&counter]{ counter++; }).then([&counter]{ counter++; return counter.load(); }).get();
+    ASSERT_EQ(counter,2);
+    // the exceptions skip the continuations
+    auto e = submit(pool,[]() -> int { throw std::runtime_error("job failure"); }).then([&counter](int v){ counter++; return v; });
+    ASSERT_THROW(e.get(),std::runtime_error);
+    ASSERT_EQ(counter,2);
+}
+
+TEST(Future, WhenAll) {
+    BasicThreadPool pool(4);
+    pool.start();
+    std::vector<Future<int>> futures;
+    for (int i=0; i<100; i++)
+        futures.push_back(submit(pool,[i]{ return i*i; }));
+    auto results = when_all(pool,std::move(futures)).get();
+    ASSERT_EQ(results.size(),100u);
+    for (int i=0; i<100; i++)
+        ASSERT_EQ(results[i],i*i);
+    // void futures
+    std::atomic<int32_t> counter(0);
+    std::vector<Future<void>> jobs;
+    for (int i=0; i<50; i++)
+        jobs.push_back(submit(pool,[&counter]{ counter++; }));
+    when_all(pool,std::move(jobs)).get();
+    ASSERT_EQ(counter,50);
+    // failures and empty sets
+    std::vector<Future<int>> failing;
+    failing.push_back(submit(pool,[]{ return 1; }));
+    failing.push_back(submit(pool,[]() -> int { throw std::runtime_error("job failure"); }));
+    ASSERT_THROW(when_all(pool,std::move(failing)).get(),std::runtime_error);
+    ASSERT_TRUE(when_all(pool,std::vector<Future<int>>()).get().empty());
+}
+
+TEST(Future, WhenAny) {
+    BasicThreadPool pool(2);
+    pool.start();
+    std::atomic<bool> release(false);
+    std::vector<Future<int>> futures;
+    // the first job waits until the second one has won
+    futures.push_back(submit(pool,[&release]{
+        while (!release)
+            std::this_thread::yield();
+        return 1;
+    }));
+    futures.push_back(submit(pool,[]{ return 2; }));
+    auto any = when_any(pool,std::move(futures)).get();
+    ASSERT_EQ(any.index,1u);
+    ASSERT_EQ(any.futures.size(),2u);
+    ASSERT_EQ(any.futures[1].get(),2);
+    release = true;
+    ASSERT_EQ(any.futures[0].get(),1);
+    ASSERT_EQ(when_any(pool,std::vector<Future<int>>()).get().index,SIZE_MAX);
+}
+
+TEST(Future, GetInJob) {
+    // a job waiting for futures executes the jobs producing them
+    BasicThreadPool pool(1);
+    pool.start();
+    BasicThreadPool *p = &pool;
+    auto outer = submit(pool,[p]{
+        std::vector<Future<int>> inner;
+        for (int i=0; i<20; i++)
+            inner.push_back(submit(*p,[i]{ return i; }));
+        int sum = 0;
+        for (auto &f: inner)
+            sum += f.get();
+        return sum;
+    });
+    ASSERT_EQ(outer.get(),190);
+}
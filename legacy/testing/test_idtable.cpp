@@ -1,5 +1,7 @@
 #include <iostream>
 #include <thread>
+#include <vector>
+#include <cstdio>
 
 #include "gtest/gtest.h"
 
@@ -79,3 +81,174 @@ TEST(IDTable, Remove) {
     ASSERT_TRUE(idtable.has(id4));
 }
 
+TEST(IDTable, FreeList) {
+    IDTable<int64_t> idtable;
+    auto id1 = idtable.add(1);
+    auto id2 = idtable.add(2);
+    auto id3 = idtable.add(3);
+    idtable.remove(id1);
+    idtable.remove(id3);
+    // the free slots are reused in LIFO order, without growing the _ids array
+    auto id4 = idtable.add(4);
+    auto id5 = idtable.add(5);
+    ASSERT_EQ(id4.index,id3.index);
+    ASSERT_EQ(id5.index,id1.index);
+    ASSERT_EQ(idtable._ids.size(),3);
+    ASSERT_EQ(idtable.get(id2),2);
+    ASSERT_EQ(idtable.get(id4),4);
+    ASSERT_EQ(idtable.get(id5),5);
+}
+
+TEST(IDTable, RemoveMoved) {
+    IDTable<int64_t> idtable;
+    std::vector<ID> ids;
+    for (int64_t i=0; i<8; i++)
+        ids.push_back(idtable.add(i));
+    // the removals move the last objects in the freed positions: the moved objects must still be reachable
+    idtable.remove(ids[1]);
+    idtable.remove(ids[7]);
+    idtable.remove(ids[3]);
+    idtable.remove(ids[6]);
+    for (int64_t i: {0,2,4,5})
+        ASSERT_EQ(idtable.get(ids[i]),i);
+    // a removed id must not be found, even if its slot is in the free list
+    for (int64_t i: {1,3,6,7})
+        ASSERT_FALSE(idtable.has(ids[i]));
+    ASSERT_FALSE(idtable.has(ID{ids[3].index,ids[7].index}));
+}
+
+TEST(IDTable, SaveLoad) {
+    const char *filename = "idtable_snapshot.bin";
+    IDTable<int64_t> idtable;
+    std::vector<ID> ids;
+    for (auto i=0; i<1000; i++)
+        ids.push_back(idtable.add(i));
+    for (auto i=0; i<1000; i+=3)
+        idtable.remove(ids[i]);
+    ASSERT_TRUE(idtable.save(filename));
+
+    IDTable<int64_t> loaded;
+    ASSERT_TRUE(loaded.load(filename));
+    ASSERT_EQ(loaded.size(),idtable.size());
+    ASSERT_EQ(loaded._ids.size(),idtable._ids.size());
+    // the arrays are used in place from the mapped file
+    ASSERT_TRUE(loaded._objects.get_allocator().mapped(loaded._objects.data()));
+    for (auto i=0; i<1000; i++) {
+        ASSERT_EQ(loaded.has(ids[i]),i%3!=0);
+        if (i%3!=0)
+            ASSERT_EQ(loaded.get(ids[i]),i);
+    }
+    // the loaded table can be modified (copy-on-write), including the free list state
+    loaded.get(ids[1]) = -1;
+    auto id = loaded.add(2000);
+    ASSERT_EQ(id.index,ids[999].index);
+    ASSERT_EQ(loaded.get(id),2000);
+    ASSERT_EQ(loaded._ids.size(),idtable._ids.size());
+    // the file is not modified by the changes in memory
+    IDTable<int64_t> reloaded;
+    ASSERT_TRUE(reloaded.load(filename));
+    ASSERT_EQ(reloaded.get(ids[1]),1);
+    ASSERT_FALSE(reloaded.has(id));
+    // snapshots of a different type are refused
+    IDTable<int32_t> wrong_type;
+    ASSERT_FALSE(wrong_type.load(filename));
+    ASSERT_FALSE(wrong_type.load("missing_snapshot.bin"));
+    remove(filename);
+}
+
+TEST(IDTable, LoadCorrupt) {
+    const char *filename = "idtable_corrupt.bin";
+    IDTable<int64_t> idtable;
+    for (auto i=0; i<100; i++)
+        idtable.add(i);
+    ASSERT_TRUE(idtable.save(filename));
+    IDTableFileHeader header;
+    FILE *fp = fopen(filename,"rb");
+    ASSERT_TRUE(fp!=nullptr);
+    ASSERT_EQ(fread(&header,sizeof(header),1,fp),1u);
+    fclose(fp);
+    auto write_header = [&](const IDTableFileHeader &h) {
+        FILE *f = fopen(filename,"r+b");
+        fwrite(&h,sizeof(h),1,f);
+        fclose(f);
+    };
+    // array lengths whose size in bytes wraps around
+    IDTableFileHeader corrupt = header;
+    corrupt.num_objects = UINT64_MAX/sizeof(int64_t)+2;
+    write_header(corrupt);
+    IDTable<int64_t> loaded;
+    ASSERT_FALSE(loaded.load(filename));
+    // offsets not aligned to the cache lines
+    corrupt = header;
+    corrupt.objects_offset += 8;
+    write_header(corrupt);
+    ASSERT_FALSE(loaded.load(filename));
+    // offsets beyond the end of the file
+    corrupt = header;
+    corrupt.lookup_offset = UINT64_MAX-CACHE_LINE_SIZE+1;
+    write_header(corrupt);
+    ASSERT_FALSE(loaded.load(filename));
+    // more objects than stored in the arrays
+    corrupt = header;
+    corrupt.size = header.num_objects+1;
+    write_header(corrupt);
+    ASSERT_FALSE(loaded.load(filename));
+    // free list head outside the id array
+    corrupt = header;
+    corrupt.freelist_idx = header.num_ids;
+    write_header(corrupt);
+    ASSERT_FALSE(loaded.load(filename));
+    // more ids than the 32 bit indices can address
+    corrupt = header;
+    corrupt.num_ids = uint64_t(UINT32_MAX)+1;
+    write_header(corrupt);
+    ASSERT_FALSE(loaded.load(filename));
+    write_header(header);
+    ASSERT_TRUE(loaded.load(filename));
+    ASSERT_EQ(loaded.size(),100u);
+    remove(filename);
+}
+
+TEST(IDTable, ChangeTracking) {
+    IDTable<int64_t> idtable;
+    auto id1 = idtable.add(1);
+    // changes are tracked only while there are consumers
+    auto c1 = idtable.add_consumer();
+    ASSERT_TRUE(idtable._changes.empty());
+    auto id2 = idtable.add(2);
+    idtable.get_mut(id1) = 10;
+    idtable.get_mut(id1) = 11; // reported once
+    auto c2 = idtable.add_consumer();
+    idtable.get_mut(id1) = 12; // new for c2
+    idtable.remove(id2);
+    std::vector<Change> changes1, changes2;
+    idtable.for_each_change(c1,[&](const Change &c) {  changes1.push_back(c);  });
+    idtable.for_each_change(c2,[&](const Change &c) {  changes2.push_back(c);  });
+    ASSERT_EQ(changes1.size(),4);
+    ASSERT_EQ(changes1[0].type,ChangeType::ADDED);
+    ASSERT_EQ(changes1[0].id.index,id2.index);
+    ASSERT_EQ(changes1[1].type,ChangeType::MODIFIED);
+    ASSERT_EQ(changes1[1].id.index,id1.index);
+    ASSERT_EQ(changes1[3].type,ChangeType::REMOVED);
+    ASSERT_EQ(changes2.size(),2);
+    ASSERT_EQ(changes2[0].type,ChangeType::MODIFIED);
+    ASSERT_EQ(changes2[1].type,ChangeType::REMOVED);
+    // each consumer advances independently
+    idtable.clear_changes(c1);
+    idtable.get_mut(id1) = 13;
+    changes1.clear();
+    changes2.clear();
+    idtable.for_each_change(c1,[&](const Change &c) {  changes1.push_back(c);  });
+    idtable.for_each_change(c2,[&](const Change &c) {  changes2.push_back(c);  });
+    ASSERT_EQ(changes1.size(),1);
+    ASSERT_EQ(changes2.size(),3);
+    // the log is released once all the consumers have seen it
+    idtable.clear_changes(c1);
+    idtable.clear_changes(c2);
+    ASSERT_TRUE(idtable._changes.empty());
+    idtable.remove_consumer(c1);
+    idtable.remove_consumer(c2);
+    idtable.get_mut(id1) = 14;
+    ASSERT_TRUE(idtable._changes.empty());
+}
+
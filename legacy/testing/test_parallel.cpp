@@ -0,0 +1,99 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "gtest/gtest.h"
+
+#include "threadpool/parallel.h"
+
+namespace {
+    struct NestedData {
+        BasicThreadPool *pool;
+        int64_t          result;
+    };
+    // parallel loop started from inside a job
+    void nested_fun(Job *job) {
+        NestedData *d = *((NestedData**)job->local_data);
+        d->result = parallel_reduce(*d->pool,0,10000,16,int64_t(0),
+                                    [](int64_t i) {  return i;  },
+                                    [](int64_t a, int64_t b) {  return a+b;  });
+    }
+}
+
+
+TEST(Parallel, For) {
+    BasicThreadPool pool(4);
+    pool.start();
+    std::vector<int32_t> values(1000000,0);
+    parallel_for(pool,0,values.size(),1000,[&](int64_t i) {  values[i] += i%7;  });
+    for (size_t i=0; i<values.size(); i++)
+        ASSERT_EQ(values[i],i%7);
+    // empty range and small grains
+    parallel_for(pool,10,10,1,[&](int64_t i) {  values[i] = -1;  });
+    ASSERT_EQ(values[10],3);
+    parallel_for(pool,0,1000,0,[&](int64_t i) {  values[i] = -1;  });
+    for (size_t i=0; i<1000; i++)
+        ASSERT_EQ(values[i],-1);
+}
+
+TEST(Parallel, ForRange) {
+    BasicThreadPool pool(4);
+    pool.start();
+    std::vector<std::atomic<int32_t>> visits(100000);
+    for (auto &v: visits)
+        v = 0;
+    std::atomic<int32_t> num_ranges(0);
+    parallel_for_range(pool,0,visits.size(),64,[&](int64_t b, int64_t e) {
+        num_ranges++;
+        for (int64_t i=b; i<e; i++)
+            visits[i]++;
+    });
+    // every element is visited exactly once
+    for (auto &v: visits)
+        ASSERT_EQ(v,1);
+    ASSERT_GT(num_ranges,0);
+}
+
+TEST(Parallel, Reduce) {
+    ThreadPool pool(4);
+    pool.start();
+    const int64_t n = 1000000;
+    auto sum = parallel_reduce(pool,0,n,256,int64_t(0),
+                               [](int64_t i) {  return i;  },
+                               [](int64_t a, int64_t b) {  return a+b;  });
+    ASSERT_EQ(sum,n*(n-1)/2);
+    auto max = parallel_reduce(pool,0,n,256,int64_t(-1),
+                               [](int64_t i) {  return (i*7919)%n;  },
+                               [](int64_t a, int64_t b) {  return std::max(a,b);  });
+    ASSERT_EQ(max,n-1);
+    auto empty = parallel_reduce(pool,5,5,1,int64_t(1),
+                                 [](int64_t i) {  return i;  },
+                                 [](int64_t a, int64_t b) {  return a*b;  });
+    ASSERT_EQ(empty,1);
+}
+
+TEST(Parallel, Serial) {
+    // without workers the loops run on the calling thread
+    BasicThreadPool pool(0);
+    std::vector<int32_t> values(1000,0);
+    parallel_for(pool,0,values.size(),10,[&](int64_t i) {  values[i] = 1;  });
+    auto sum = parallel_reduce(pool,0,values.size(),10,0,
+                               [&](int64_t i) {  return values[i];  },
+                               [](int32_t a, int32_t b) {  return a+b;  });
+    ASSERT_EQ(sum,1000);
+}
+
+TEST(Parallel, Nested) {
+    BasicThreadPool pool(4);
+    pool.start();
+    std::vector<NestedData> data(8,NestedData{&pool,0});
+    JobCounter jobs;
+    for (auto &d: data) {
+        NestedData *ptr = &d;
+        pool.add_job(Job(nested_fun,ptr),&jobs);
+    }
+    pool.wait_for(jobs);
+    for (auto &d: data)
+        ASSERT_EQ(d.result,10000*9999/2);
+}
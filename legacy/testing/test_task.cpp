@@ -0,0 +1,84 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "threadpool/task.h"
+
+#if THREADPOOL_HAS_COROUTINES
+
+namespace {
+    Task<int> square(BasicThreadPool &pool, int v) {
+        co_await pool.schedule();
+        co_return v*v;
+    }
+    Task<int> sum_of_squares(BasicThreadPool &pool, int n) {
+        int sum = 0;
+        for (int i=0; i<n; i++)
+            sum += co_await square(pool,i);
+        co_return sum;
+    }
+    Task<void> fail(BasicThreadPool &pool) {
+        co_await pool.schedule();
+        throw std::runtime_error("task failure");
+    }
+
+    void increment_fun(Job *job) {
+        (*(std::atomic<int32_t>**)job->local_data)->fetch_add(1);
+    }
+    // submit jobs and suspend until they are complete
+    Task<int32_t> await_jobs(BasicThreadPool &pool, int32_t n) {
+        co_await pool.schedule();
+        std::atomic<int32_t> count(0);
+        std::atomic<int32_t> *ptr = &count;
+        JobCounter jobs;
+        for (int32_t i=0; i<n; i++)
+            pool.add_job(Job(increment_fun,ptr),&jobs);
+        co_await jobs;
+        co_return count.load();
+    }
+}
+
+TEST(Task, Schedule) {
+    BasicThreadPool pool(2);
+    pool.start();
+    ASSERT_EQ(sync_wait(pool,sum_of_squares(pool,10)),285);
+}
+
+TEST(Task, WhenAll) {
+    BasicThreadPool pool(4);
+    pool.start();
+    std::vector<Task<int>> tasks;
+    for (int i=0; i<100; i++)
+        tasks.push_back(square(pool,i));
+    auto results = sync_wait(pool,when_all(pool,std::move(tasks)));
+    ASSERT_EQ(results.size(),100u);
+    for (int i=0; i<100; i++)
+        ASSERT_EQ(results[i],i*i);
+
+    std::vector<Task<int32_t>> nested;
+    for (int i=0; i<10; i++)
+        nested.push_back(await_jobs(pool,50));
+    for (auto r: sync_wait(pool,when_all(pool,std::move(nested))))
+        ASSERT_EQ(r,50);
+}
+
+TEST(Task, AwaitCounter) {
+    ThreadPool pool(2);
+    pool.start();
+    for (int i=0; i<20; i++)
+        ASSERT_EQ(sync_wait(pool,await_jobs(pool,100)),100);
+    ASSERT_EQ(sync_wait(pool,await_jobs(pool,0)),0);
+}
+
+TEST(Task, Exception) {
+    BasicThreadPool pool(2);
+    pool.start();
+    ASSERT_THROW(sync_wait(pool,fail(pool)),std::runtime_error);
+    std::vector<Task<void>> tasks;
+    tasks.push_back(fail(pool));
+    ASSERT_THROW(sync_wait(pool,when_all(pool,std::move(tasks))),std::runtime_error);
+}
+
+#endif
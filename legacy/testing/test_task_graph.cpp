@@ -0,0 +1,126 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+#include "threadpool/task_graph.h"
+
+
+TEST(TaskGraph, Compile) {
+    TaskGraph graph;
+    auto a = graph.add_node(nullptr);
+    auto b = graph.add_node(nullptr);
+    auto c = graph.add_node(nullptr);
+    graph.add_edge(c,b);
+    graph.add_edge(b,a);
+    ASSERT_TRUE(graph.compile());
+    ASSERT_EQ(graph.order(),(std::vector<uint32_t>{c,b,a}));
+    // cycles are detected
+    graph.add_edge(a,c);
+    ASSERT_FALSE(graph.compile());
+    BasicThreadPool pool(1);
+    ASSERT_FALSE(graph.launch(pool));
+}
+
+TEST(TaskGraph, Run) {
+    ThreadPool pool(4);
+    pool.start();
+    // layered graph: every node of a layer depends on all the nodes of the previous layer
+    const uint32_t layers = 10;
+    const uint32_t width = 30;
+    std::atomic<uint32_t> sequence(0);
+    std::vector<uint32_t> stamps(layers*width,0);
+    TaskGraph graph;
+    for (uint32_t i=0; i<layers*width; i++)
+        graph.add_node([&,i]{  stamps[i] = ++sequence;  });
+    for (uint32_t l=1; l<layers; l++)
+        for (uint32_t i=0; i<width; i++)
+            for (uint32_t j=0; j<width; j++)
+                graph.add_edge((l-1)*width+j,l*width+i);
+    // the same graph is executed many times
+    for (int frame=0; frame<50; frame++) {
+        sequence = 0;
+        ASSERT_TRUE(graph.run(pool));
+        ASSERT_TRUE(graph.done());
+        ASSERT_EQ(sequence,layers*width);
+        for (uint32_t l=1; l<layers; l++) {
+            uint32_t prev_max = *std::max_element(stamps.begin()+(l-1)*width,stamps.begin()+l*width);
+            uint32_t cur_min = *std::min_element(stamps.begin()+l*width,stamps.begin()+(l+1)*width);
+            ASSERT_LT(prev_max,cur_min);
+        }
+    }
+}
+
+TEST(TaskGraph, Serial) {
+    BasicThreadPool pool(0);
+    std::vector<int> order;
+    TaskGraph graph;
+    auto a = graph.add_node([&]{  order.push_back(0);  });
+    auto b = graph.add_node([&]{  order.push_back(1);  });
+    graph.add_edge(b,a);
+    ASSERT_TRUE(graph.run(pool));
+    ASSERT_EQ(order,(std::vector<int>{1,0}));
+}
+
+TEST(TaskGraph, CriticalPath) {
+    ThreadPool pool(1);
+    pool.start();
+    std::vector<uint32_t> order;
+    TaskGraph graph;
+    // independent nodes declared before a chain of 3 nodes
+    for (uint32_t i=0; i<5; i++)
+        graph.add_node([&,i]{  order.push_back(i);  });
+    auto a = graph.add_node([&]{  order.push_back(5);  });
+    auto b = graph.add_node([&]{  order.push_back(6);  });
+    auto c = graph.add_node([&]{  order.push_back(7);  });
+    graph.add_edge(a,b);
+    graph.add_edge(b,c);
+    // the chain is started first, since it is the longest path
+    ASSERT_EQ(graph.policy(),TaskGraphPolicy::CRITICAL_PATH);
+    ASSERT_TRUE(graph.run(pool));
+    ASSERT_EQ(order.size(),8);
+    ASSERT_EQ(order[0],5);
+    ASSERT_EQ(order[1],6);
+    ASSERT_GT(graph.priority(a),graph.priority(b));
+    ASSERT_GT(graph.priority(b),graph.priority(c));
+    for (uint32_t i=0; i<graph.size(); i++)
+        ASSERT_GT(graph.duration(i),0);
+    // with the FIFO policy the roots are executed in submission order
+    order.clear();
+    graph.set_policy(TaskGraphPolicy::FIFO);
+    ASSERT_TRUE(graph.run(pool));
+    ASSERT_EQ(order.size(),8);
+    ASSERT_EQ(order[0],0);
+}
+
+TEST(TaskGraph, Cancel) {
+    BasicThreadPool pool(2);
+    pool.start();
+    // chain of nodes: the third one cancels the execution
+    CancellationToken token;
+    std::atomic<uint32_t> executed(0);
+    TaskGraph graph;
+    for (uint32_t i=0; i<10; i++)
+        graph.add_node([&,i]{
+            executed++;
+            if (i==2)
+                token.cancel();
+        });
+    for (uint32_t i=1; i<10; i++)
+        graph.add_edge(i-1,i);
+    for (auto policy: {TaskGraphPolicy::FIFO,TaskGraphPolicy::CRITICAL_PATH}) {
+        executed = 0;
+        token.cancelled = false;
+        graph.set_policy(policy);
+        ASSERT_TRUE(graph.run(pool,&token));
+        ASSERT_EQ(executed,3u);
+        ASSERT_TRUE(graph.done());
+    }
+    // a new launch without the token runs all the nodes
+    executed = 0;
+    ASSERT_TRUE(graph.run(pool));
+    ASSERT_EQ(executed,10u);
+}
@@ -3,10 +3,27 @@
 #include <mutex>
 #include <condition_variable>
 #include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#ifdef __linux__
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "gtest/gtest.h"
 
 #include "threadpool/threadpool.h"
+#include "tracing/tracing.h"
+
+#if defined(__GNUC__)
+#define THREADPOOL_TEST_NOINLINE __attribute__((noinline))
+#else
+#define THREADPOOL_TEST_NOINLINE
+#endif
 
 namespace {
     void my_job_func(Job *job) {
@@ -80,6 +97,42 @@ TEST(BasicThreadPool, Job) {
         ASSERT_EQ(job.local_data[i],0);
 }
 
+TEST(BasicThreadPool, JobCallables) {
+    // the local data is aligned for any trivially copyable data
+    ASSERT_EQ(offsetof(Job,local_data)%16,0u);
+    BasicThreadPool pool(2);
+    pool.start();
+    std::atomic<int32_t> counter(0);
+    // small trivially copyable callables are stored inline
+    for (int i=0; i<100; i++)
+        pool.add_job(Job([&counter,i]() {  counter += i;  }));
+    // larger or not trivially copyable callables are moved to the slab allocator
+    char payload[100] = {1};
+    auto shared = std::make_shared<int32_t>(2);
+    for (int i=0; i<100; i++) {
+        pool.add_job(Job([&counter,payload]() {  counter += payload[0];  }));
+        pool.add_job(Job([&counter,shared]() {  counter += *shared;  }));
+    }
+    pool.wait();
+    ASSERT_EQ(counter,4950+100+200);
+    // the copies held by the jobs have been destroyed
+    ASSERT_EQ(shared.use_count(),1);
+}
+
+TEST(SlabAllocator, Reuse) {
+    // released blocks are reused by the allocations of the same size class
+    void *a = SlabAllocator::allocate(100);
+    SlabAllocator::deallocate(a,100);
+    void *b = SlabAllocator::allocate(120);
+    ASSERT_EQ(a,b);
+    void *c = SlabAllocator::allocate(120);
+    ASSERT_NE(b,c);
+    SlabAllocator::deallocate(b,120);
+    SlabAllocator::deallocate(c,120);
+    void *large = SlabAllocator::allocate(SlabAllocator::max_size+1);
+    SlabAllocator::deallocate(large,SlabAllocator::max_size+1);
+}
+
 TEST(BasicThreadPool, Creation) {
     BasicThreadPool pool(4);
     for (auto i=0; i<100; i++) {
@@ -151,3 +204,978 @@ TEST(ThreadPool, Depend) {
     ASSERT_EQ(pippoary.ary[99],1);
 }
 
+namespace {
+    struct SpawnData {
+        BasicThreadPool      *pool;
+        std::atomic<int32_t> *counter;
+        int32_t               depth;
+    };
+    // each job spawns two children from inside the worker, down to depth 0
+    void spawn_fun(Job *job) {
+        SpawnData &d = *((SpawnData*)job->local_data);
+        d.counter->fetch_add(1);
+        if (d.depth>0) {
+            SpawnData child {d.pool,d.counter,d.depth-1};
+            d.pool->add_job(Job(spawn_fun,child));
+            d.pool->add_job(Job(spawn_fun,child));
+        }
+    }
+}
+
+TEST(WorkStealingQueue, Order) {
+    WorkStealingQueue<uint32_t,16> q;
+    uint32_t v = 0;
+    ASSERT_FALSE(q.pop(v));
+    ASSERT_FALSE(q.steal(v));
+    for (uint32_t i=0; i<16; i++)
+        ASSERT_TRUE(q.push(i));
+    // the queue is full
+    ASSERT_FALSE(q.push(16));
+    ASSERT_EQ(q.size(),16);
+    // the owner pops the newest, the thieves steal the oldest
+    ASSERT_TRUE(q.pop(v));
+    ASSERT_EQ(v,15);
+    ASSERT_TRUE(q.steal(v));
+    ASSERT_EQ(v,0);
+    ASSERT_EQ(q.size(),14);
+}
+
+TEST(WorkStealingQueue, ConcurrentSteal) {
+    const uint32_t n = 100000;
+    WorkStealingQueue<uint32_t,1024> q;
+    std::vector<std::atomic<uint32_t>> taken(n);
+    for (auto &t: taken)
+        t = 0;
+    std::atomic<bool> done(false);
+    std::vector<std::thread> thieves;
+    for (int i=0; i<3; i++) {
+        thieves.push_back(std::thread([&]{
+            uint32_t v;
+            while (!done || !q.empty())
+                if (q.steal(v))
+                    taken[v]++;
+        }));
+    }
+    // the owner pushes all the items, popping some of them
+    uint32_t v;
+    for (uint32_t i=0; i<n; i++) {
+        while (!q.push(i))
+            if (q.pop(v))
+                taken[v]++;
+        if (i%3==0 && q.pop(v))
+            taken[v]++;
+    }
+    done = true;
+    for (auto &t: thieves)
+        t.join();
+    // every item must be taken exactly once
+    for (uint32_t i=0; i<n; i++)
+        ASSERT_EQ(taken[i],1);
+}
+
+TEST(BasicThreadPool, NestedJobs) {
+    BasicThreadPool pool(4);
+    std::atomic<int32_t> counter(0);
+    SpawnData d {&pool,&counter,10};
+    pool.add_job(Job(spawn_fun,d));
+    pool.start();
+    // jobs added by the workers go to their local queues and are stolen by the idle workers
+    pool.wait();
+    ASSERT_EQ(counter,(1<<11)-1);
+    ASSERT_EQ(pool.open_jobs(),0);
+}
+
+namespace {
+    void count_fun(Job *job) {
+        std::atomic<int32_t> *counter = *((std::atomic<int32_t>**)job->local_data);
+        counter->fetch_add(1);
+    }
+}
+
+TEST(BasicThreadPool, ManyJobs) {
+    BasicThreadPool pool(4);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    // more jobs than the capacity of a job ring: the submitting thread uses several shared rings
+    const int32_t n = 3*job_ring_size+10;
+    for (auto i=0; i<n; i++)
+        pool.add_job(Job(count_fun,ptr));
+    ASSERT_EQ(pool.open_jobs(),n);
+    pool.start();
+    pool.wait();
+    ASSERT_EQ(counter,n);
+}
+
+TEST(ThreadPool, Unlock) {
+    ThreadPool pool(2);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    pool.start();
+    // a locked job without children is scheduled as soon as it is unlocked
+    auto id = pool.add_locked_job(Job(count_fun,ptr));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ASSERT_EQ(counter,0);
+    pool.unlock_job(id);
+    pool.wait();
+    ASSERT_EQ(counter,1);
+}
+
+TEST(ThreadPool, ParentNotLocked) {
+    ThreadPool pool(2);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    pool.start();
+    // a running job is not a parent: its children must not schedule it again
+    struct Self {
+        ID                id;
+        std::atomic<bool> known{false};
+    } self;
+    Self *s = &self;
+    ThreadPool *p = &pool;
+    JobCounter done;
+    self.id = pool.add_job(Job([p,ptr,s]{
+        while (!s->known)
+            std::this_thread::yield();
+        JobCounter children;
+        for (int i=0; i<10; i++)
+            p->add_job(Job(count_fun,ptr,s->id),&children);
+        p->wait_for(children);
+        (*ptr) += 100;
+    }),&done);
+    self.known = true;
+    pool.wait_for(done);
+    pool.wait();
+    ASSERT_EQ(counter,110);
+    // neither is a queued job that was not created locked
+    ThreadPool paused(1);
+    counter = 0;
+    ID queued = paused.add_job(Job(count_fun,ptr));
+    paused.add_job(Job(count_fun,ptr,queued));
+    paused.start();
+    paused.wait();
+    ASSERT_EQ(counter,2);
+}
+
+namespace {
+    struct BatchData {
+        BasicThreadPool      *pool;
+        std::atomic<int32_t> *counter;
+    };
+    // submit a batch of jobs from a worker
+    void batch_fun(Job *job) {
+        BatchData d;
+        memcpy(&d,job->local_data,sizeof(d));
+        std::vector<Job> jobs(5000,Job(count_fun,d.counter));
+        JobCounter children;
+        d.pool->add_jobs(jobs.data(),jobs.size(),&children);
+        d.pool->wait_for(children);
+    }
+}
+
+TEST(BasicThreadPool, BatchJobs) {
+    BasicThreadPool pool(4);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    // from outside the workers: the batch is larger than a job ring
+    std::vector<Job> jobs(10000,Job(count_fun,ptr));
+    std::vector<ID> ids(jobs.size());
+    JobCounter batch;
+    pool.add_jobs(jobs.data(),jobs.size(),&batch,JobPriority::NORMAL,ids.data());
+    ASSERT_EQ(batch.value,10000);
+    ASSERT_EQ(pool.open_jobs(),10000u);
+    for (auto &id: ids)
+        ASSERT_TRUE(valid(id));
+    pool.start();
+    pool.wait_for(batch);
+    ASSERT_EQ(counter,10000);
+    // from a worker: the batch goes to the local queue, overflowing to the shared queue
+    pool.add_job(Job(batch_fun,BatchData{&pool,ptr}));
+    pool.wait();
+    ASSERT_EQ(counter,15000);
+}
+
+TEST(BasicThreadPool, IdlePolicy) {
+    // waves of jobs, submitted while the workers are parking (no polling) or polling
+    for (unsigned int poll_us: {0u,50u}) {
+        ThreadPoolConfig config(4);
+        config.idle_spin_us = poll_us;
+        config.idle_yield_us = poll_us;
+        BasicThreadPool pool(config);
+        pool.start();
+        std::atomic<int32_t> counter(0);
+        std::atomic<int32_t> *ptr = &counter;
+        int32_t expected = 0;
+        for (int i=0; i<300; i++) {
+            JobCounter jobs;
+            for (int k=0; k<=i%5; k++, expected++)
+                pool.add_job(Job(count_fun,ptr),&jobs);
+            pool.wait_for(jobs);
+            if (i%50==0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(counter,expected);
+    }
+}
+
+TEST(CpuTopology, ParseCpuList) {
+    ASSERT_EQ(CpuTopology::parse_cpu_list("0"),std::vector<unsigned int>({0}));
+    ASSERT_EQ(CpuTopology::parse_cpu_list("0-3,8,10-11\n"),std::vector<unsigned int>({0,1,2,3,8,10,11}));
+    ASSERT_TRUE(CpuTopology::parse_cpu_list("").empty());
+}
+
+TEST(CpuTopology, Placement) {
+    // 2 nodes of 2 cores with 2 hardware threads, siblings numbered consecutively
+    CpuTopology topology;
+    for (unsigned int i=0; i<8; i++) {
+        CpuInfo info;
+        info.cpu = i;
+        info.core = i/2;
+        info.smt_rank = i%2;
+        info.l3_domain = i/4;
+        info.node = i/4;
+        topology.add_cpu(info);
+    }
+    ASSERT_EQ(topology.num_cores(),4u);
+    ASSERT_EQ(topology.num_nodes(),2u);
+    ASSERT_EQ(topology.node_of(5),1u);
+    // one worker per physical core first, then the siblings
+    ASSERT_EQ(topology.placement(),std::vector<unsigned int>({0,2,4,6,1,3,5,7}));
+    // the machine has at least one cpu
+    auto detected = CpuTopology::detect();
+    ASSERT_GE(detected.num_cpus(),1u);
+    ASSERT_GE(detected.num_nodes(),1u);
+    ASSERT_EQ(detected.placement().size(),detected.num_cpus());
+}
+
+#ifdef __linux__
+namespace {
+    // fake sysfs tree in a temporary directory, removed on destruction
+    struct FakeSysfs {
+        std::string              root;
+        std::vector<std::string> files;
+        std::vector<std::string> dirs;
+
+        FakeSysfs() {
+            char tmpl[] = "/tmp/sysfsXXXXXX";
+            root = mkdtemp(tmpl);
+        }
+        ~FakeSysfs() {
+            for (auto &f: files)
+                std::remove(f.c_str());
+            for (auto it=dirs.rbegin(); it!=dirs.rend(); ++it)
+                rmdir(it->c_str());
+            rmdir(root.c_str());
+        }
+        void write(const std::string &path, const std::string &content) {
+            for (size_t pos=path.find('/'); pos!=std::string::npos; pos=path.find('/',pos+1)) {
+                std::string dir = root+"/"+path.substr(0,pos);
+                if (mkdir(dir.c_str(),0755)==0)
+                    dirs.push_back(dir);
+            }
+            files.push_back(root+"/"+path);
+            FILE *fp = fopen(files.back().c_str(),"w");
+            fprintf(fp,"%s\n",content.c_str());
+            fclose(fp);
+        }
+    };
+}
+
+TEST(CpuTopology, Sysfs) {
+    // 2 packages with one core of 2 hardware threads each; a L3 cache and a node per package
+    FakeSysfs sysfs;
+    sysfs.write("devices/system/cpu/online","0-3");
+    for (unsigned int cpu=0; cpu<4; cpu++) {
+        std::string dir = "devices/system/cpu/cpu"+std::to_string(cpu);
+        sysfs.write(dir+"/topology/physical_package_id",std::to_string(cpu/2));
+        sysfs.write(dir+"/topology/core_id","0");
+        sysfs.write(dir+"/cache/index0/level","1");
+        sysfs.write(dir+"/cache/index0/shared_cpu_list",std::to_string(cpu));
+        sysfs.write(dir+"/cache/index1/level","3");
+        sysfs.write(dir+"/cache/index1/shared_cpu_list",cpu<2 ? "0-1" : "2-3");
+    }
+    sysfs.write("devices/system/node/node0/cpulist","0-1");
+    sysfs.write("devices/system/node/node1/cpulist","2-3");
+    auto topology = CpuTopology::from_sysfs(sysfs.root);
+    ASSERT_EQ(topology.num_cpus(),4u);
+    ASSERT_EQ(topology.num_cores(),2u);
+    ASSERT_EQ(topology.num_l3_domains(),2u);
+    ASSERT_EQ(topology.num_nodes(),2u);
+    ASSERT_EQ(topology.cpus()[1].core,0u);
+    ASSERT_EQ(topology.cpus()[1].smt_rank,1u);
+    ASSERT_EQ(topology.cpus()[2].l3_domain,1u);
+    ASSERT_EQ(topology.node_of(3),1u);
+    ASSERT_EQ(topology.placement(),std::vector<unsigned int>({0,2,1,3}));
+    // missing tree
+    ASSERT_EQ(CpuTopology::from_sysfs(sysfs.root+"/missing").num_cpus(),0u);
+}
+#endif
+
+namespace {
+    struct NodeData {
+        BasicThreadPool      *pool;
+        std::atomic<int32_t> *counter;
+    };
+    // submit jobs for both nodes from a worker
+    void node_fun(Job *job) {
+        NodeData &d = *((NodeData*)job->local_data);
+        for (unsigned int i=0; i<100; i++)
+            d.pool->add_job_on_node(Job(count_fun,d.counter),i%2);
+    }
+}
+
+TEST(BasicThreadPool, NodeQueues) {
+    // 2 nodes of 2 cpus: the pinning fails on the cpus missing in the machine, the workers run unpinned
+    CpuTopology topology;
+    for (unsigned int i=0; i<4; i++) {
+        CpuInfo info;
+        info.cpu = i;
+        info.core = i;
+        info.l3_domain = i/2;
+        info.node = i/2;
+        topology.add_cpu(info);
+    }
+    ThreadPoolConfig config(4);
+    config.pin_workers = true;
+    config.topology = &topology;
+    BasicThreadPool pool(config);
+    ASSERT_EQ(pool.num_nodes(),2u);
+    for (unsigned int w=0; w<4; w++)
+        ASSERT_EQ(pool.worker_node(w),w/2);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    // from outside the workers, with and without hints
+    JobCounter jobs;
+    for (unsigned int i=0; i<300; i++) {
+        if (i%3==2)
+            pool.add_job(Job(count_fun,ptr),&jobs);
+        else
+            pool.add_job_on_node(Job(count_fun,ptr),i%3,&jobs);
+    }
+    ASSERT_EQ(pool.open_jobs(),300u);
+    pool.start();
+    pool.wait_for(jobs);
+    ASSERT_EQ(counter,300);
+    // from the workers
+    pool.add_job(Job(node_fun,NodeData{&pool,ptr}));
+    pool.wait();
+    ASSERT_EQ(counter,400);
+    // without pinning there is a single node
+    BasicThreadPool flat(2);
+    ASSERT_EQ(flat.num_nodes(),1u);
+    ASSERT_EQ(flat.worker_node(1),0u);
+}
+
+TEST(BasicThreadPool, Cancellation) {
+    BasicThreadPool pool(2);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    // the jobs of a cancelled token are dropped when dequeued; the children tokens are cancelled with the parent
+    CancellationToken request;
+    CancellationToken subtask(&request);
+    CancellationToken other;
+    JobCounter jobs;
+    for (int i=0; i<100; i++) {
+        pool.add_job(Job(count_fun,ptr),&jobs,JobPriority::NORMAL,&request);
+        pool.add_job(Job(count_fun,ptr),&jobs,JobPriority::NORMAL,&subtask);
+        pool.add_job(Job(count_fun,ptr),&jobs,JobPriority::NORMAL,&other);
+    }
+    // callables stored out of line are released without being called
+    auto resource = std::make_shared<int>(0);
+    pool.add_job(Job([resource,ptr]{ (*ptr)+=1000; }),&jobs,JobPriority::NORMAL,&request);
+    ASSERT_EQ(resource.use_count(),2);
+    request.cancel();
+    ASSERT_TRUE(subtask.is_cancelled());
+    ASSERT_FALSE(other.is_cancelled());
+    pool.start();
+    pool.wait_for(jobs);
+    ASSERT_EQ(counter,100);
+    ASSERT_EQ(resource.use_count(),1);
+    // running jobs poll the token
+    CancellationToken running;
+    CancellationToken *token = &running;
+    JobCounter loop;
+    pool.add_job(Job([token]{ while (!token->is_cancelled()) std::this_thread::yield(); }),&loop);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    ASSERT_FALSE(loop.done());
+    running.cancel();
+    pool.wait_for(loop);
+}
+
+TEST(ThreadPool, Clear) {
+    ThreadPool pool(2);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    // open jobs, and a locked parent unlocked when its children are dropped
+    JobCounter jobs;
+    auto parent = pool.add_locked_job(Job(count_fun,ptr),&jobs);
+    for (int i=0; i<100; i++)
+        pool.add_job(Job(count_fun,ptr,parent),&jobs);
+    pool.unlock_job(parent);
+    ASSERT_EQ(pool.open_jobs(),100u);
+    pool.clear();
+    ASSERT_EQ(pool.open_jobs(),0u);
+    ASSERT_TRUE(jobs.done());
+    pool.start();
+    pool.wait();
+    ASSERT_EQ(counter,0);
+    // the pool works normally afterwards
+    pool.add_job(Job(count_fun,ptr));
+    pool.wait();
+    ASSERT_EQ(counter,1);
+}
+
+TEST(BasicThreadPool, Elastic) {
+    ThreadPoolConfig config(1);
+    config.max_workers = 4;
+    config.grow_delay_us = 200;
+    config.idle_timeout_ms = 20;
+    config.manager_period_us = 100;
+    BasicThreadPool pool(config);
+    ASSERT_EQ(pool.num_workers(),1u);
+    ASSERT_EQ(pool.max_workers(),4u);
+    pool.start();
+    // the only worker blocks: a worker is added to run the queued jobs
+    std::atomic<bool> release(false);
+    std::atomic<bool> *flag = &release;
+    BasicThreadPool *p = &pool;
+    JobCounter blocked;
+    pool.add_job(Job([p,flag]{
+        auto region = p->blocking_region();
+        while (!*flag)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }),&blocked);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    JobCounter jobs;
+    for (int i=0; i<10; i++)
+        pool.add_job(Job(count_fun,ptr),&jobs);
+    pool.wait_for(jobs);
+    ASSERT_EQ(counter,10);
+    ASSERT_GE(pool.num_workers(),2u);
+    release = true;
+    pool.wait_for(blocked);
+    // the idle added workers exit
+    for (int i=0; i<500 && pool.num_workers()>1; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    ASSERT_EQ(pool.num_workers(),1u);
+    // a backlog of slow jobs adds workers, up to max_workers
+    std::atomic<uint32_t> max_seen(0);
+    std::atomic<uint32_t> *seen = &max_seen;
+    for (int i=0; i<200; i++)
+        pool.add_job(Job([p,seen]{
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            uint32_t n = p->num_workers();
+            uint32_t m = seen->load();
+            while (n>m && !seen->compare_exchange_weak(m,n)) {}
+        }));
+    pool.wait();
+    ASSERT_GT(max_seen,1u);
+    ASSERT_LE(max_seen,4u);
+}
+
+TEST(TimerWheel, Expiration) {
+    TimerWheel<int> wheel;
+    std::vector<std::pair<uint64_t,int>> fired;
+    auto record = [&](ID, int &v) {  fired.push_back(std::make_pair(wheel.now(),v));  };
+    // deadlines in every level, and beyond the range of the wheel
+    std::vector<uint64_t> deadlines = {1, 5, 63, 64, 65, 100, 4095, 4096, 5000, 300000, 20000000, 40000000};
+    for (size_t i=0; i<deadlines.size(); i++)
+        wheel.add(deadlines[i],(int)i);
+    ASSERT_EQ(wheel.size(),deadlines.size());
+    ASSERT_EQ(wheel.next_tick(),1u);
+    wheel.advance(64,record);
+    ASSERT_EQ(fired.size(),4u);
+    wheel.advance(50000000,record);
+    ASSERT_EQ(fired.size(),deadlines.size());
+    for (size_t i=0; i<deadlines.size(); i++) {
+        ASSERT_EQ(fired[i].first,deadlines[i]);
+        ASSERT_EQ(fired[i].second,(int)i);
+    }
+    ASSERT_EQ(wheel.size(),0u);
+    ASSERT_EQ(wheel.next_tick(),UINT64_MAX);
+    // past deadlines expire at the next tick
+    wheel.add(10,-1);
+    ASSERT_EQ(wheel.next_tick(),50000001u);
+}
+
+TEST(TimerWheel, CancelAndPeriodic) {
+    TimerWheel<int> wheel(1000);
+    std::vector<int> fired;
+    auto record = [&](ID, int &v) {  fired.push_back(v);  };
+    ID a = wheel.add(1010,1);
+    ID b = wheel.add(1020,2);
+    ID c = wheel.add(2000,3);
+    ASSERT_TRUE(wheel.cancel(b));
+    ASSERT_FALSE(wheel.cancel(b));
+    ASSERT_EQ(*wheel.get(a),1);
+    ASSERT_EQ(wheel.get(b),nullptr);
+    wheel.advance(1500,record);
+    ASSERT_EQ(fired,std::vector<int>({1}));
+    // the handles of the expired timers are stale, also when their slots are reused
+    ID d = wheel.add(1600,4);
+    ASSERT_EQ(d.index,a.index);
+    ASSERT_FALSE(wheel.cancel(a));
+    ASSERT_TRUE(wheel.cancel(c));
+    ASSERT_TRUE(wheel.cancel(d));
+    // periodic timers fire every period until cancelled
+    fired.clear();
+    ID p = wheel.add(1510,7,10);
+    wheel.advance(1600,record);
+    ASSERT_EQ(fired.size(),10u);
+    ASSERT_EQ(wheel.size(),1u);
+    ASSERT_TRUE(wheel.cancel(p));
+    wheel.advance(1700,record);
+    ASSERT_EQ(fired.size(),10u);
+    // clear visits the pending timers
+    wheel.add(1800,8);
+    wheel.add(100000,9);
+    int sum = 0;
+    wheel.clear([&sum](ID, int &v) {  sum += v;  });
+    ASSERT_EQ(sum,17);
+    ASSERT_EQ(wheel.size(),0u);
+}
+
+TEST(BasicThreadPool, DelayedJobs) {
+    ThreadPoolConfig config(2);
+    config.timer_tick_us = 100;
+    BasicThreadPool pool(config);
+    pool.start();
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    // the jobs are not submitted before their delay
+    JobCounter done;
+    auto start = std::chrono::steady_clock::now();
+    pool.add_job_after(std::chrono::milliseconds(20),Job(count_fun,ptr),&done);
+    pool.add_job_after(std::chrono::milliseconds(10),Job([ptr]{ (*ptr) += 10; }),&done);
+    ASSERT_EQ(pool.pending_timers(),2u);
+    pool.wait_for(done);
+    ASSERT_GE(std::chrono::steady_clock::now()-start,std::chrono::milliseconds(20));
+    ASSERT_EQ(counter,11);
+    // cancelled timers release their counters and their callables
+    auto shared = std::make_shared<int>(0);
+    ID timer = pool.add_job_after(std::chrono::seconds(10),Job([shared,ptr]{ (*ptr)++; }),&done);
+    ASSERT_EQ(shared.use_count(),2);
+    ASSERT_TRUE(pool.cancel_timer(timer));
+    ASSERT_FALSE(pool.cancel_timer(timer));
+    ASSERT_TRUE(done.done());
+    ASSERT_EQ(shared.use_count(),1);
+    ASSERT_EQ(pool.pending_timers(),0u);
+    // periodic jobs are submitted until cancelled
+    ASSERT_FALSE(valid(pool.add_periodic_job(std::chrono::milliseconds(1),Job([shared]{}))));
+    counter = 0;
+    ID periodic = pool.add_periodic_job(std::chrono::milliseconds(1),Job(count_fun,ptr));
+    while (counter<5)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    ASSERT_TRUE(pool.cancel_timer(periodic));
+    pool.wait();
+    int32_t fired = counter;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ASSERT_EQ(counter,fired);
+    // the pending timers are dropped with the pool
+    std::unique_ptr<BasicThreadPool> other(new BasicThreadPool(1));
+    other->add_job_after(std::chrono::seconds(10),Job([shared]{}));
+    ASSERT_EQ(shared.use_count(),2);
+    other.reset();
+    ASSERT_EQ(shared.use_count(),1);
+}
+
+TEST(BasicThreadPool, WorkerStats) {
+    ThreadPoolConfig config(2);
+    config.idle_spin_us = 0;
+    config.idle_yield_us = 0;
+    BasicThreadPool pool(config);
+    pool.start();
+    // the workers park when there is nothing to do
+    for (int i=0; i<500 && pool.worker_stats(0).parked+pool.worker_stats(1).parked<2; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // a job submitting children to its own queue, where they can be stolen
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    BasicThreadPool *p = &pool;
+    JobCounter done;
+    pool.add_job(Job([p,ptr]{
+        JobCounter children;
+        for (int i=0; i<100; i++)
+            p->spawn(Job(count_fun,ptr),children);
+        p->sync(children);
+    }),&done);
+    pool.wait_for(done);
+    ASSERT_EQ(counter,100);
+    WorkerStats total;
+    for (unsigned int w=0; w<pool.max_workers(); w++) {
+        WorkerStats stats = pool.worker_stats(w);
+        total.jobs_run += stats.jobs_run;
+        total.steals += stats.steals;
+        total.idle_ns += stats.idle_ns;
+        total.parked += stats.parked;
+        total.queue_high_water = std::max(total.queue_high_water,stats.queue_high_water);
+    }
+    ASSERT_EQ(total.jobs_run,101u);
+    ASSERT_GE(total.parked,2u);
+    ASSERT_GT(total.idle_ns,0u);
+    ASSERT_GE(total.queue_high_water,1u);
+    ASSERT_LE(total.queue_high_water,100u);
+    ASSERT_LE(total.steals,100u);
+}
+
+TEST(ThreadPool, TraceJobs) {
+    const char *filename = "test_threadpool_trace.json";
+    trc_init(filename,10000);
+    {
+        ThreadPoolConfig config(2);
+        config.trace_jobs = true;
+        ThreadPool pool(config);
+        pool.start();
+        std::atomic<int32_t> counter(0);
+        std::atomic<int32_t> *ptr = &counter;
+        BasicThreadPool *p = &pool;
+        JobCounter done;
+        pool.add_job(Job([p,ptr]{
+            JobCounter children;
+            for (int i=0; i<10; i++)
+                p->spawn(Job(count_fun,ptr),children);
+            p->sync(children);
+        }),&done);
+        pool.wait_for(done);
+        ASSERT_EQ(counter,10);
+    }
+    trc_shutdown();
+    std::string trace;
+    FILE *fp = fopen(filename,"r");
+    ASSERT_NE(fp,nullptr);
+    char buf[4096];
+    size_t n;
+    while ((n=fread(buf,1,sizeof(buf),fp))>0)
+        trace.append(buf,n);
+    fclose(fp);
+    remove(filename);
+    // a duration event per job, a flow from the parent to each child; the job submitted from outside has no flow
+    auto count = [&trace](const std::string &pattern) {
+        size_t num = 0;
+        for (size_t pos=trace.find(pattern); pos!=std::string::npos; pos=trace.find(pattern,pos+1))
+            num++;
+        return num;
+    };
+    ASSERT_EQ(count("\"ph\":\"X\""),11u);
+    ASSERT_EQ(count("\"ph\":\"s\""),10u);
+    ASSERT_EQ(count("\"ph\":\"f\""),10u);
+}
+
+TEST(ThreadPool, BatchLockedJobs) {
+    ThreadPool pool(2);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    pool.start();
+    std::vector<Job> jobs(100,Job(count_fun,ptr));
+    std::vector<ID> ids(jobs.size());
+    pool.add_locked_jobs(jobs.data(),jobs.size(),ids.data());
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ASSERT_EQ(counter,0);
+    pool.unlock_jobs(ids.data(),ids.size());
+    pool.wait();
+    ASSERT_EQ(counter,100);
+}
+
+namespace {
+    struct WaitData {
+        BasicThreadPool      *pool;
+        std::atomic<int32_t> *counter;
+        bool                  ok;
+    };
+    // spawn children referencing a counter and wait for them from inside the worker
+    void wait_children_fun(Job *job) {
+        WaitData &d = **((WaitData**)job->local_data);
+        JobCounter children;
+        for (int i=0; i<20; i++)
+            d.pool->add_job(Job(count_fun,d.counter),&children);
+        d.pool->wait_for(children);
+        d.ok = d.counter->load()==20;
+    }
+}
+
+TEST(BasicThreadPool, WaitFor) {
+    BasicThreadPool pool(4);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    JobCounter jobs;
+    for (auto i=0; i<100; i++)
+        pool.add_job(Job(count_fun,ptr),&jobs);
+    ASSERT_EQ(jobs.value,100);
+    ASSERT_FALSE(jobs.done());
+    pool.start();
+    // the calling thread sleeps until the counter reaches zero
+    pool.wait_for(jobs);
+    ASSERT_TRUE(jobs.done());
+    ASSERT_EQ(counter,100);
+}
+
+TEST(BasicThreadPool, WaitForInJob) {
+    // a single worker must execute the children itself while waiting for them
+    BasicThreadPool pool(1);
+    std::atomic<int32_t> counter(0);
+    WaitData d {&pool,&counter,false};
+    WaitData *ptr = &d;
+    JobCounter parent;
+    pool.add_job(Job(wait_children_fun,ptr),&parent);
+    pool.start();
+    pool.wait_for(parent);
+    ASSERT_TRUE(d.ok);
+    pool.wait();
+    ASSERT_EQ(counter,20);
+}
+
+namespace {
+    struct OrderData {
+        std::vector<int> *order;
+        std::mutex       *mutex;
+        int               value;
+    };
+    void order_fun(Job *job) {
+        OrderData d;
+        memcpy(&d,job->local_data,sizeof(d));
+        std::unique_lock<std::mutex> lock(*d.mutex);
+        d.order->push_back(d.value);
+    }
+}
+
+TEST(BasicThreadPool, Priorities) {
+    ThreadPoolConfig config(1);
+    config.aging_period = 0;
+    BasicThreadPool pool(config);
+    std::vector<int> order;
+    std::mutex mutex;
+    const JobPriority levels[] = {JobPriority::BACKGROUND, JobPriority::NORMAL, JobPriority::HIGH};
+    for (int l=0; l<3; l++)
+        for (int i=0; i<10; i++)
+            pool.add_job(Job(order_fun,OrderData{&order,&mutex,(int)levels[l]}),levels[l]);
+    ASSERT_EQ(pool.open_jobs(),30);
+    ASSERT_EQ(pool.open_jobs(JobPriority::HIGH),10);
+    pool.start();
+    pool.wait();
+    // the higher levels are executed first
+    ASSERT_EQ(order.size(),30);
+    for (int i=0; i<30; i++)
+        ASSERT_EQ(order[i],i/10);
+}
+
+TEST(BasicThreadPool, Aging) {
+    ThreadPoolConfig config(1);
+    config.aging_period = 4;
+    BasicThreadPool pool(config);
+    std::vector<int> order;
+    std::mutex mutex;
+    for (int i=0; i<5; i++)
+        pool.add_job(Job(order_fun,OrderData{&order,&mutex,(int)JobPriority::BACKGROUND}),JobPriority::BACKGROUND);
+    for (int i=0; i<20; i++)
+        pool.add_job(Job(order_fun,OrderData{&order,&mutex,(int)JobPriority::NORMAL}));
+    pool.start();
+    pool.wait();
+    // every 4 jobs a background job is executed, even if there are normal jobs
+    ASSERT_EQ(order.size(),25);
+    for (int i=0; i<20; i++)
+        ASSERT_EQ(order[i],(int)((i+1)%4==0 ? JobPriority::BACKGROUND : JobPriority::NORMAL));
+}
+
+namespace {
+    void block_fun(Job *job) {
+        std::atomic<bool> *release = *((std::atomic<bool>**)job->local_data);
+        while (!*release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+TEST(BasicThreadPool, ReservedWorkers) {
+    ThreadPoolConfig config(2);
+    config.num_high_priority_workers = 1;
+    BasicThreadPool pool(config);
+    pool.start();
+    std::atomic<bool> release(false);
+    std::atomic<bool> *ptr = &release;
+    // the normal worker is busy, and the reserved worker doesn't execute normal jobs
+    pool.add_job(Job(block_fun,ptr));
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *counter_ptr = &counter;
+    pool.add_job(Job(count_fun,counter_ptr));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(counter,0);
+    // high priority jobs are still executed
+    JobCounter high;
+    pool.add_job(Job(count_fun,counter_ptr),&high,JobPriority::HIGH);
+    pool.wait_for(high);
+    ASSERT_EQ(counter,1);
+    release = true;
+    pool.wait();
+    ASSERT_EQ(counter,2);
+}
+
+namespace {
+    struct SortData {
+        BasicThreadPool *pool;
+        int32_t         *begin;
+        int32_t         *end;
+    };
+    // parallel quicksort: the partitions are sorted by child jobs
+    void quicksort_fun(Job *job) {
+        SortData d;
+        memcpy(&d,job->local_data,sizeof(d));
+        if (d.end-d.begin<=256) {
+            std::sort(d.begin,d.end);
+            return;
+        }
+        int32_t pivot = d.begin[(d.end-d.begin)/2];
+        int32_t *mid1 = std::partition(d.begin,d.end,[pivot](int32_t v) {  return v<pivot;  });
+        int32_t *mid2 = std::partition(mid1,d.end,[pivot](int32_t v) {  return v==pivot;  });
+        JobCounter children;
+        d.pool->spawn(Job(quicksort_fun,SortData{d.pool,d.begin,mid1}),children);
+        d.pool->spawn(Job(quicksort_fun,SortData{d.pool,mid2,d.end}),children);
+        d.pool->sync(children);
+    }
+
+    struct FibData {
+        BasicThreadPool *pool;
+        int32_t          n;
+        int64_t         *result;
+    };
+    // naive recursive fibonacci, nesting much deeper than the number of workers
+    void fib_fun(Job *job) {
+        FibData d;
+        memcpy(&d,job->local_data,sizeof(d));
+        if (d.n<2) {
+            *d.result = d.n;
+            return;
+        }
+        int64_t a = 0, b = 0;
+        JobCounter children;
+        d.pool->spawn(Job(fib_fun,FibData{d.pool,d.n-1,&a}),children);
+        d.pool->spawn(Job(fib_fun,FibData{d.pool,d.n-2,&b}),children);
+        d.pool->sync(children);
+        *d.result = a+b;
+    }
+}
+
+TEST(BasicThreadPool, ForkJoinQuicksort) {
+    BasicThreadPool pool(4);
+    pool.start();
+    std::vector<int32_t> values(200000);
+    uint32_t state = 1;
+    for (auto &v: values) {
+        state = state*1664525u+1013904223u;
+        v = state>>8;
+    }
+    JobCounter root;
+    pool.spawn(Job(quicksort_fun,SortData{&pool,values.data(),values.data()+values.size()}),root);
+    pool.sync(root);
+    ASSERT_TRUE(std::is_sorted(values.begin(),values.end()));
+}
+
+TEST(ThreadPool, ForkJoinDeepNesting) {
+    ThreadPool pool(2);
+    pool.start();
+    int64_t result = 0;
+    JobCounter root;
+    pool.spawn(Job(fib_fun,FibData{&pool,18,&result}),root);
+    pool.sync(root);
+    ASSERT_EQ(result,2584);
+}
+
+#if THREADPOOL_HAS_FIBERS
+namespace {
+    struct OverflowFiber {
+        FiberContext  context;
+        FiberContext *caller;
+    };
+    // recurse until the stack is exhausted
+    THREADPOOL_TEST_NOINLINE int recurse(volatile char *prev, int depth) {
+        volatile char frame[256];
+        frame[0] = prev ? prev[0]+1 : 0;
+        return depth>1000000 ? frame[0] : recurse(frame,depth+1)+1;
+    }
+    void overflow_fiber(void *ptr) {
+        recurse(nullptr,0);
+        auto fiber = static_cast<OverflowFiber*>(ptr);
+        fiber->context.switch_to(*fiber->caller);
+    }
+}
+
+TEST(FiberContext, GuardPage) {
+    // a fiber overflowing its stack hits the guard page and crashes, instead of writing in the next allocations
+    ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+    ASSERT_DEATH({
+        FiberContext caller;
+        OverflowFiber fiber;
+        fiber.caller = &caller;
+        if (fiber.context.create(16*1024,overflow_fiber,&fiber))
+            caller.switch_to(fiber.context);
+        fprintf(stderr,"no overflow\n");
+        exit(0);
+    },"");
+}
+#endif
+
+TEST(BasicThreadPool, Fibers) {
+    // the waiting jobs are parked, and the single worker executes the children in other fibers
+    ThreadPoolConfig config(1);
+    config.use_fibers = true;
+    BasicThreadPool pool(config);
+    std::atomic<int32_t> counter(0);
+    std::vector<WaitData> data(10,WaitData{&pool,&counter,false});
+    JobCounter parents;
+    for (auto &d: data) {
+        WaitData *ptr = &d;
+        pool.add_job(Job(wait_children_fun,ptr),&parents);
+    }
+    pool.start();
+    pool.wait_for(parents);
+    pool.wait();
+    ASSERT_EQ(counter,200);
+}
+
+TEST(BasicThreadPool, FibersReleasedExternally) {
+    // a fiber parked on a counter released by a non-worker thread is resumed, even with the worker parked
+    ThreadPoolConfig config(1);
+    config.use_fibers = true;
+    config.idle_spin_us = 0;
+    config.idle_yield_us = 0;
+    BasicThreadPool pool(config);
+    JobCounter timer_done;
+    ID timer = pool.add_job_after(std::chrono::seconds(10),Job([]{}),&timer_done);
+    std::atomic<int32_t> counter(0);
+    std::atomic<int32_t> *ptr = &counter;
+    BasicThreadPool *pool_ptr = &pool;
+    JobCounter *timer_ptr = &timer_done;
+    JobCounter done;
+    pool.add_job(Job([pool_ptr,timer_ptr,ptr]{  pool_ptr->wait_for(*timer_ptr); (*ptr)++;  }),&done);
+    pool.start();
+    // the worker parks the fiber, then parks itself
+    for (int i=0; i<500 && pool.worker_stats(0).parked<2; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    ASSERT_TRUE(pool.cancel_timer(timer));
+    for (int i=0; i<2000 && !done.done(); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    ASSERT_TRUE(done.done());
+    ASSERT_EQ(counter,1);
+}
+
+TEST(ThreadPool, FibersForkJoin) {
+    // few fibers: when they are all parked the jobs run on the worker stacks
+    ThreadPoolConfig config(2);
+    config.use_fibers = true;
+    config.num_fibers = 8;
+    ThreadPool pool(config);
+    pool.start();
+    int64_t result = 0;
+    JobCounter root;
+    pool.spawn(Job(fib_fun,FibData{&pool,18,&result}),root);
+    pool.sync(root);
+    ASSERT_EQ(result,2584);
+
+    std::vector<int32_t> values(100000);
+    uint32_t state = 1;
+    for (auto &v: values) {
+        state = state*1664525u+1013904223u;
+        v = state>>8;
+    }
+    pool.spawn(Job(quicksort_fun,SortData{&pool,values.data(),values.data()+values.size()}),root);
+    pool.sync(root);
+    ASSERT_TRUE(std::is_sorted(values.begin(),values.end()));
+}
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "common/versioned_idtable.h"
+
+TEST(VersionedIDTable, AddRemove) {
+    VersionedIDTable<int64_t,4> idtable;
+    auto id1 = idtable.add(1);
+    auto id2 = idtable.add(2);
+    auto id3 = idtable.add(3);
+    ASSERT_EQ(idtable.size(),3);
+    ASSERT_TRUE(idtable.remove(id2));
+    ASSERT_FALSE(idtable.remove(id2));
+    ASSERT_TRUE(idtable.has(id1));
+    ASSERT_FALSE(idtable.has(id2));
+    ASSERT_TRUE(idtable.has(id3));
+    auto id4 = idtable.add(4);
+    ASSERT_EQ(id4.index,id2.index);
+    ASSERT_EQ(idtable.get(id1),1);
+    ASSERT_EQ(idtable.get(id3),3);
+    ASSERT_EQ(idtable.get(id4),4);
+}
+
+TEST(VersionedIDTable, RemoveStale) {
+    VersionedIDTable<int64_t,4> idtable;
+    std::vector<ID> ids;
+    for (int64_t i=0; i<8; i++)
+        ids.push_back(idtable.add(i));
+    ASSERT_TRUE(idtable.remove(ids[3]));
+    ASSERT_TRUE(idtable.remove(ids[7]));
+    // a free slot stores the next free index where the internal id was: an id matching it is stale
+    ID stale {ids[7].index,ids[3].index};
+    ASSERT_FALSE(idtable.has(stale));
+    ASSERT_FALSE(idtable.remove(stale));
+    // the removals are not affected, and the free slots are reused
+    auto id8 = idtable.add(8);
+    auto id9 = idtable.add(9);
+    ASSERT_EQ(id8.index,ids[7].index);
+    ASSERT_EQ(id9.index,ids[3].index);
+    ASSERT_FALSE(idtable.has(ids[3]));
+    ASSERT_FALSE(idtable.has(ids[7]));
+    ASSERT_EQ(idtable.size(),8u);
+    for (int64_t i: {0,1,2,4,5,6})
+        ASSERT_EQ(idtable.get(ids[i]),i);
+    ASSERT_EQ(idtable.get(id8),8);
+    ASSERT_EQ(idtable.get(id9),9);
+    idtable.publish();
+    ASSERT_FALSE(idtable.snapshot()->has(stale));
+}
+
+TEST(VersionedIDTable, Snapshot) {
+    VersionedIDTable<int64_t,4> idtable;
+    std::vector<ID> ids;
+    for (auto i=0; i<16; i++)
+        ids.push_back(idtable.add(i));
+    ASSERT_EQ(idtable.snapshot()->size(),0);
+    ASSERT_EQ(idtable.publish(),1);
+    auto v1 = idtable.snapshot();
+    ASSERT_EQ(v1->version(),1);
+    ASSERT_EQ(v1->size(),16);
+    // modifications are not visible in the published snapshot
+    idtable.get_mut(ids[5]) = 100;
+    idtable.remove(ids[0]);
+    ASSERT_EQ(v1->get(ids[5]),5);
+    ASSERT_TRUE(v1->has(ids[0]));
+    idtable.publish();
+    auto v2 = idtable.snapshot();
+    ASSERT_EQ(v2->get(ids[5]),100);
+    ASSERT_FALSE(v2->has(ids[0]));
+    ASSERT_EQ(v2->size(),15);
+    // only the modified chunks have been copied
+    ASSERT_NE(v1->_objects.chunk(1),v2->_objects.chunk(1));
+    ASSERT_EQ(v1->_objects.chunk(2),v2->_objects.chunk(2));
+    int64_t sum = 0;
+    v2->for_each([&](const int64_t &v) {  sum += v;  });
+    ASSERT_EQ(sum,120-5+100);
+    // a chunk is copied at most once per published version
+    auto chunk = idtable._current._objects.chunk(1);
+    idtable.get_mut(ids[5]) = 200;
+    ASSERT_NE(idtable._current._objects.chunk(1),chunk);
+    chunk = idtable._current._objects.chunk(1);
+    idtable.get_mut(ids[6]) = 300;
+    ASSERT_EQ(idtable._current._objects.chunk(1),chunk);
+    ASSERT_EQ(v2->get(ids[5]),100);
+}
+
+TEST(VersionedIDTable, ConcurrentReaders) {
+    VersionedIDTable<int64_t,64> idtable;
+    std::vector<ID> ids;
+    for (auto i=0; i<1000; i++)
+        ids.push_back(idtable.add(0));
+    idtable.publish();
+    std::atomic<bool> done(false);
+    std::atomic<int> inconsistent(0);
+    std::vector<std::thread> readers;
+    for (auto r=0; r<3; r++) {
+        readers.push_back(std::thread([&]() {
+            while (!done) {
+                // every snapshot must contain the values of a single frame
+                auto snapshot = idtable.snapshot();
+                int64_t frame = snapshot->get(ids[0]);
+                snapshot->for_each([&](const int64_t &v) {  if (v!=frame) inconsistent++;  });
+            }
+        }));
+    }
+    for (int64_t frame=1; frame<=200; frame++) {
+        for (auto id: ids)
+            idtable.get_mut(id) = frame;
+        idtable.publish();
+    }
+    done = true;
+    for (auto &r: readers)
+        r.join();
+    ASSERT_EQ(inconsistent,0);
+    ASSERT_EQ(idtable.snapshot()->get(ids[999]),200);
+}
+
@@ -0,0 +1,195 @@
+#include "cpu_topology.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// local functions
+namespace {
+
+// read the first line of a file
+bool read_line(const std::string &path, std::string &line) {
+    FILE *fp = fopen(path.c_str(),"r");
+    if (!fp)
+        return false;
+    char buf[4096];
+    bool ok = fgets(buf,sizeof(buf),fp)!=nullptr;
+    fclose(fp);
+    if (!ok)
+        return false;
+    line = buf;
+    while (!line.empty() && (line.back()=='\n' || line.back()==' '))
+        line.pop_back();
+    return true;
+}
+
+bool read_uint(const std::string &path, unsigned int &value) {
+    std::string line;
+    if (!read_line(path,line) || line.empty())
+        return false;
+    value = strtoul(line.c_str(),nullptr,10);
+    return true;
+}
+
+// map sparse keys to dense indices, in order of first appearance
+template <typename Key>
+unsigned int dense_index(std::map<Key,unsigned int> &indices, const Key &key) {
+    auto it = indices.find(key);
+    if (it!=indices.end())
+        return it->second;
+    unsigned int idx = indices.size();
+    indices[key] = idx;
+    return idx;
+}
+
+}
+
+
+CpuTopology CpuTopology::detect() {
+    CpuTopology topology = from_sysfs("/sys");
+    if (topology.num_cpus()==0)
+        topology = flat(std::max(std::thread::hardware_concurrency(),1u));
+    return topology;
+}
+
+CpuTopology CpuTopology::from_sysfs(const std::string &root) {
+    CpuTopology topology;
+    std::string line;
+    std::string cpu_dir = root+"/devices/system/cpu";
+    if (!read_line(cpu_dir+"/online",line))
+        return topology;
+    auto cpus = parse_cpu_list(line);
+    // NUMA nodes: the node directories list their cpus
+    std::map<unsigned int,unsigned int> cpu_nodes;
+    for (unsigned int n=0; n<1024; n++) {
+        if (!read_line(root+"/devices/system/node/node"+std::to_string(n)+"/cpulist",line))
+            continue;
+        for (auto cpu: parse_cpu_list(line))
+            cpu_nodes[cpu] = n;
+    }
+    std::map<std::pair<unsigned int,unsigned int>,unsigned int> cores;
+    std::map<unsigned int,unsigned int> l3_domains, nodes;
+    std::map<unsigned int,unsigned int> core_threads;
+    for (auto cpu: cpus) {
+        std::string dir = cpu_dir+"/cpu"+std::to_string(cpu);
+        CpuInfo info;
+        info.cpu = cpu;
+        unsigned int core_id = cpu;
+        read_uint(dir+"/topology/physical_package_id",info.package);
+        read_uint(dir+"/topology/core_id",core_id);
+        info.core = dense_index(cores,std::make_pair(info.package,core_id));
+        info.smt_rank = core_threads[info.core]++;
+        // the L3 domain is identified by the first cpu sharing the cache
+        unsigned int l3_key = 0x80000000u+info.package;
+        for (unsigned int i=0; i<16; i++) {
+            unsigned int level = 0;
+            std::string cache_dir = dir+"/cache/index"+std::to_string(i);
+            if (!read_uint(cache_dir+"/level",level))
+                break;
+            if (level==3 && read_line(cache_dir+"/shared_cpu_list",line)) {
+                auto shared = parse_cpu_list(line);
+                if (!shared.empty())
+                    l3_key = shared.front();
+            }
+        }
+        info.l3_domain = dense_index(l3_domains,l3_key);
+        info.node = dense_index(nodes,cpu_nodes.count(cpu) ? cpu_nodes[cpu] : 0u);
+        topology._cpus.push_back(info);
+    }
+    topology._num_cores = cores.size();
+    topology._num_l3_domains = l3_domains.size();
+    topology._num_nodes = nodes.size();
+    return topology;
+}
+
+CpuTopology CpuTopology::flat(unsigned int num_cpus) {
+    CpuTopology topology;
+    for (unsigned int i=0; i<num_cpus; i++) {
+        CpuInfo info;
+        info.cpu = i;
+        info.core = i;
+        topology.add_cpu(info);
+    }
+    return topology;
+}
+
+std::vector<unsigned int> CpuTopology::parse_cpu_list(const std::string &list) {
+    std::vector<unsigned int> cpus;
+    const char *p = list.c_str();
+    while (*p) {
+        char *end;
+        unsigned long first = strtoul(p,&end,10);
+        if (end==p)
+            break;
+        unsigned long last = first;
+        p = end;
+        if (*p=='-') {
+            last = strtoul(p+1,&end,10);
+            p = end;
+        }
+        for (unsigned long cpu=first; cpu<=last; cpu++)
+            cpus.push_back(cpu);
+        if (*p==',')
+            p++;
+    }
+    return cpus;
+}
+
+void CpuTopology::add_cpu(const CpuInfo &info) {
+    _cpus.push_back(info);
+    _num_cores = std::max(_num_cores,info.core+1);
+    _num_l3_domains = std::max(_num_l3_domains,info.l3_domain+1);
+    _num_nodes = std::max(_num_nodes,info.node+1);
+}
+
+unsigned int CpuTopology::node_of(unsigned int cpu) const {
+    for (auto &info: _cpus)
+        if (info.cpu==cpu)
+            return info.node;
+    return 0;
+}
+
+std::vector<unsigned int> CpuTopology::placement() const {
+    std::vector<CpuInfo> sorted = _cpus;
+    std::stable_sort(sorted.begin(),sorted.end(),[](const CpuInfo &a, const CpuInfo &b) {
+        if (a.smt_rank!=b.smt_rank) return a.smt_rank<b.smt_rank;
+        if (a.node!=b.node)         return a.node<b.node;
+        if (a.l3_domain!=b.l3_domain) return a.l3_domain<b.l3_domain;
+        return a.core<b.core;
+    });
+    std::vector<unsigned int> order;
+    for (auto &info: sorted)
+        order.push_back(info.cpu);
+    return order;
+}
+
+
+bool pin_current_thread(unsigned int cpu) {
+#ifdef __linux__
+    if (cpu>=CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu,&set);
+    return pthread_setaffinity_np(pthread_self(),sizeof(set),&set)==0;
+#else
+    return false;
+#endif
+}
+
+unsigned int current_cpu() {
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    return cpu>=0 ? (unsigned int)cpu : UINT32_MAX;
+#else
+    return UINT32_MAX;
+#endif
+}
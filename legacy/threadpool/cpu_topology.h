@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/// \struct CpuInfo
+/// \brief position of a logical cpu in the machine
+struct CpuInfo {
+    unsigned int cpu       = 0; ///< logical cpu index, as used by the scheduler
+    unsigned int core      = 0; ///< physical core, unique in the machine
+    unsigned int smt_rank  = 0; ///< position of the cpu among the hardware threads of its core
+    unsigned int package   = 0; ///< socket
+    unsigned int l3_domain = 0; ///< group of cpus sharing the last level cache
+    unsigned int node      = 0; ///< NUMA node
+};
+
+
+/// \class CpuTopology
+/// \brief cores, SMT siblings, L3 domains and NUMA nodes of the machine
+/// \details on Linux the topology is read from /sys/devices/system; on the other platforms (or if /sys is not
+/// readable) the machine is described as a single node of hardware_concurrency() cores without SMT.
+/// The core, L3 domain and node indices are dense, starting from 0.
+class CpuTopology {
+public:
+    /// topology of the machine
+    static CpuTopology detect();
+    /// read the topology from a sysfs tree
+    /// \param root directory containing devices/system/cpu (and devices/system/node, if any)
+    /// \return an empty topology if the cpus can't be read
+    static CpuTopology from_sysfs(const std::string &root);
+    /// single node topology with the given number of cores
+    static CpuTopology flat(unsigned int num_cpus);
+    /// parse a cpu list in the kernel format, e.g. "0-3,8,10-11"
+    static std::vector<unsigned int> parse_cpu_list(const std::string &list);
+
+    /// add a cpu; the indices of the cpu are used as they are
+    void add_cpu(const CpuInfo &info);
+
+    const std::vector<CpuInfo>& cpus() const {  return _cpus;  }
+    unsigned int num_cpus() const {  return _cpus.size();  }
+    unsigned int num_cores() const {  return _num_cores;  }
+    unsigned int num_l3_domains() const {  return _num_l3_domains;  }
+    unsigned int num_nodes() const {  return _num_nodes;  }
+    /// node of a logical cpu, 0 if the cpu is unknown
+    unsigned int node_of(unsigned int cpu) const;
+
+    /// logical cpus in placement order: the first hardware thread of every core (node after node, L3 domain
+    /// after L3 domain), then the SMT siblings. The first n cpus are the best choice for n workers.
+    std::vector<unsigned int> placement() const;
+
+private:
+    std::vector<CpuInfo> _cpus;
+    unsigned int         _num_cores = 0;
+    unsigned int         _num_l3_domains = 0;
+    unsigned int         _num_nodes = 0;
+};
+
+
+/// pin the calling thread to a logical cpu (Linux only)
+/// \return false if the thread can't be pinned
+bool pin_current_thread(unsigned int cpu);
+/// logical cpu running the calling thread, UINT32_MAX if unknown
+unsigned int current_cpu();
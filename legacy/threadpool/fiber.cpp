@@ -0,0 +1,93 @@
+#include "fiber.h"
+
+#include <cstdint>
+#include <algorithm>
+
+#if THREADPOOL_HAS_FIBERS
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// the thread sanitizer must be told about the stack switches
+#if defined(__SANITIZE_THREAD__)
+#define THREADPOOL_TSAN_FIBERS 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define THREADPOOL_TSAN_FIBERS 1
+#endif
+#endif
+#if THREADPOOL_HAS_FIBERS && defined(THREADPOOL_TSAN_FIBERS)
+#include <sanitizer/tsan_interface.h>
+#endif
+
+#if THREADPOOL_HAS_FIBERS
+
+namespace {
+
+// makecontext only passes int arguments: the function and its argument are split in 32 bit halves
+void fiber_entry(uint32_t fn_lo, uint32_t fn_hi, uint32_t arg_lo, uint32_t arg_hi) {
+    auto fn = reinterpret_cast<void (*)(void*)>((uint64_t(fn_hi)<<32) | fn_lo);
+    auto arg = reinterpret_cast<void*>((uint64_t(arg_hi)<<32) | arg_lo);
+    fn(arg);
+}
+
+}
+
+FiberContext::~FiberContext() {
+#ifdef THREADPOOL_TSAN_FIBERS
+    if (_mapping)
+        __tsan_destroy_fiber(_tsan_fiber);
+#endif
+    if (_mapping)
+        munmap(_mapping,_mapping_size);
+}
+
+bool FiberContext::create(size_t stack_size, void (*fn)(void*), void *arg) {
+    if (_mapping || getcontext(&_context)!=0)
+        return false;
+    // the stack grows down: the guard page is at the lowest address
+    size_t page = sysconf(_SC_PAGESIZE);
+    stack_size = (std::max<size_t>(stack_size,1)+page-1)/page*page;
+    void *mapping = mmap(nullptr,stack_size+page,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANON,-1,0);
+    if (mapping==MAP_FAILED)
+        return false;
+    if (mprotect(mapping,page,PROT_NONE)!=0) {
+        munmap(mapping,stack_size+page);
+        return false;
+    }
+    _mapping = mapping;
+    _mapping_size = stack_size+page;
+    _context.uc_stack.ss_sp = static_cast<char*>(mapping)+page;
+    _context.uc_stack.ss_size = stack_size;
+    _context.uc_link = nullptr;
+    uint64_t f = reinterpret_cast<uintptr_t>(fn);
+    uint64_t a = reinterpret_cast<uintptr_t>(arg);
+    makecontext(&_context,reinterpret_cast<void (*)()>(fiber_entry),4,
+                uint32_t(f),uint32_t(f>>32),uint32_t(a),uint32_t(a>>32));
+#ifdef THREADPOOL_TSAN_FIBERS
+    _tsan_fiber = __tsan_create_fiber(0);
+#endif
+    return true;
+}
+
+void FiberContext::switch_to(FiberContext &other) {
+#ifdef THREADPOOL_TSAN_FIBERS
+    _tsan_fiber = __tsan_get_current_fiber();
+    __tsan_switch_to_fiber(other._tsan_fiber,0);
+#endif
+    swapcontext(&_context,&other._context);
+}
+
+#else
+
+FiberContext::~FiberContext() {
+}
+
+bool FiberContext::create(size_t stack_size, void (*fn)(void*), void *arg) {
+    return false;
+}
+
+void FiberContext::switch_to(FiberContext &other) {
+}
+
+#endif
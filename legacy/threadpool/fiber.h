@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define THREADPOOL_HAS_FIBERS 1
+#include <ucontext.h>
+#else
+#define THREADPOOL_HAS_FIBERS 0
+#endif
+
+
+/// \class FiberContext
+/// \brief execution context of a fiber: its stack and its saved registers
+/// \details the context switch uses ucontext where available; on the other platforms create() fails and
+/// the thread pools run without fibers. A default constructed context can be used to save the state of a thread.\n
+/// The stacks are mapped from the system with an inaccessible guard page below them: a fiber overflowing its
+/// stack crashes instead of silently overwriting other memory.
+class FiberContext {
+public:
+    FiberContext() = default;
+    FiberContext(const FiberContext&) = delete;
+    ~FiberContext();
+
+    /// prepare the context to execute fn(arg) on a new stack of the given size, rounded up to whole pages.
+    /// fn must never return: it must switch to another context instead.
+    /// \return false if fibers are not supported on this platform, or the stack can't be allocated
+    bool create(size_t stack_size, void (*fn)(void*), void *arg);
+    /// save the current state in this context and resume the other context
+    void switch_to(FiberContext &other);
+
+private:
+#if THREADPOOL_HAS_FIBERS
+    ucontext_t  _context;
+#endif
+    void       *_mapping = nullptr;    ///< guard page and stack
+    size_t      _mapping_size = 0;
+    void       *_tsan_fiber = nullptr; ///< fiber handle of the thread sanitizer, if enabled
+};
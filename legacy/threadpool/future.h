@@ -0,0 +1,411 @@
+#pragma once
+
+#include "threadpool.h"
+#include "slab_allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// \file future.h
+/// \brief futures of the results of jobs
+/// \details submit(pool,fn) runs fn as a job and returns a Future of its result. The shared state of a future is
+/// allocated from the SlabAllocator and holds the result inline; a single atomic word stores the ready flag, the
+/// continuation flag and the reference count, so no lock and no std::shared_ptr are involved. A continuation
+/// attached with then() is submitted as a job by the thread completing the future (or by then() itself, if the
+/// future is already complete). Waiting with get() or wait() from a worker executes other jobs in the meantime,
+/// as wait_for() does; from a fiber it parks the job.
+
+
+template <typename T>
+class Future;
+
+namespace detail {
+
+template <typename T>
+struct WhenAllCollect;
+
+/// \struct FutureStorage
+/// \brief inline storage of the result of a future
+template <typename T>
+struct FutureStorage {
+    alignas(T) char data[sizeof(T)];
+
+    template <typename F, typename... Args>
+    void emplace(F &fn, Args&&... args) {  new(data) T(fn(std::forward<Args>(args)...));  }
+    T& get() {  return *reinterpret_cast<T*>(data);  }
+    T take() {  return std::move(get());  }
+    void destroy() {  get().~T();  }
+};
+
+template <>
+struct FutureStorage<void> {
+    template <typename F, typename... Args>
+    void emplace(F &fn, Args&&... args) {  fn(std::forward<Args>(args)...);  }
+    void take() {}
+    void destroy() {}
+};
+
+/// \struct FutureState
+/// \brief state shared by a future and the job producing its result
+/// \details the state word holds the ready and continuation flags in the lowest bits and the reference count in the
+/// others. The job producing the result and the continuation own a reference each, as the future does.
+template <typename T>
+struct FutureState {
+    static const uint32_t ready_flag = 1;        ///< the result (or the exception) is set
+    static const uint32_t continuation_flag = 2; ///< a continuation is set
+    static const uint32_t ref_unit = 4;
+
+    std::atomic<uint32_t> state;
+    JobCounter            counter;               ///< 1 until the future is ready, waited with the pool
+    BasicThreadPool      *pool;
+    Job                   continuation;          ///< job submitted when the future becomes ready
+    JobPriority           continuation_priority;
+    std::exception_ptr    exception;
+    FutureStorage<T>      storage;
+
+    static_assert(alignof(FutureStorage<T>)<=alignof(std::max_align_t), "over-aligned results are not supported");
+
+    /// allocate a state with the given number of references
+    static FutureState* create(BasicThreadPool &pool, uint32_t refs) {
+        return new(SlabAllocator::allocate(sizeof(FutureState))) FutureState(pool,refs);
+    }
+
+    void release() {
+        uint32_t old = state.fetch_sub(ref_unit,std::memory_order_acq_rel);
+        if (old/ref_unit>1)
+            return;
+        if ((old&ready_flag) && !exception)
+            storage.destroy();
+        this->~FutureState();
+        SlabAllocator::deallocate(this,sizeof(FutureState));
+    }
+    bool ready() const {  return (state.load(std::memory_order_acquire)&ready_flag)!=0;  }
+
+    /// store the result of fn(args...), or the exception it throws, and complete the future
+    template <typename F, typename... Args>
+    void run(F &fn, Args&&... args) {
+        try {
+            storage.emplace(fn,std::forward<Args>(args)...);
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        complete();
+    }
+    /// complete the future with an exception
+    void fail(std::exception_ptr e) {
+        exception = e;
+        complete();
+    }
+    /// set the job to be submitted when the future is ready: either this call or complete() submits it
+    void set_continuation(const Job &job, JobPriority priority) {
+        continuation = job;
+        continuation_priority = priority;
+        if (state.fetch_or(continuation_flag,std::memory_order_acq_rel)&ready_flag)
+            pool->add_job(continuation,nullptr,priority);
+    }
+
+private:
+    FutureState(BasicThreadPool &p, uint32_t refs)
+    : state(refs*ref_unit), counter(1), pool(&p), continuation_priority(JobPriority::NORMAL) {}
+
+    void complete() {
+        if (state.fetch_or(ready_flag,std::memory_order_acq_rel)&continuation_flag)
+            pool->add_job(continuation,nullptr,continuation_priority);
+        pool->signal(counter);
+    }
+};
+
+/// access to the state of the futures
+struct FutureAccess {
+    template <typename T>
+    static Future<T> make(FutureState<T> *state) {  return Future<T>(state);  }
+    template <typename T>
+    static FutureState<T>* state(const Future<T> &future) {  return future._state;  }
+};
+
+/// type returned by fn()
+template <typename F>
+struct ResultOf {
+    typedef decltype(std::declval<typename std::decay<F>::type&>()()) type;
+};
+
+/// type returned by the continuation fn of a Future<T>: fn(T), or fn() if T is void
+template <typename F, typename T>
+struct ContinuationResult {
+    typedef decltype(std::declval<typename std::decay<F>::type&>()(std::declval<T>())) type;
+};
+template <typename F>
+struct ContinuationResult<F,void>: ResultOf<F> {};
+
+/// job running fn and storing its result in the state
+template <typename R, typename Fn>
+struct SubmitJob {
+    FutureState<R> *state;
+    Fn              fn;
+
+    void operator()() {
+        state->run(fn);
+        state->release();
+    }
+};
+
+/// job running the continuation fn on the result of the source future
+template <typename T, typename R, typename Fn>
+struct ThenJob {
+    FutureState<T> *src;
+    FutureState<R> *dst;
+    Fn              fn;
+
+    void operator()() {
+        if (src->exception)
+            dst->fail(src->exception);
+        else
+            invoke(std::is_void<T>());
+        src->release();
+        dst->release();
+    }
+    void invoke(std::true_type) {  dst->run(fn);  }
+    void invoke(std::false_type) {  dst->run(fn,src->storage.take());  }
+};
+
+} // namespace detail
+
+
+/// \class Future
+/// \brief result of a job, available when the job completes
+/// \details a future is move only. get() and then() consume it: afterwards the future is not valid anymore.
+template <typename T>
+class Future {
+public:
+    Future()
+    : _state(nullptr) {}
+    Future(Future &&other)
+    : _state(other._state) {
+        other._state = nullptr;
+    }
+    Future& operator=(Future &&other) {
+        if (this!=&other) {
+            if (_state)
+                _state->release();
+            _state = other._state;
+            other._state = nullptr;
+        }
+        return *this;
+    }
+    Future(const Future&) = delete;
+    ~Future() {
+        if (_state)
+            _state->release();
+    }
+
+    /// true if the future refers to a result
+    bool valid() const {  return _state!=nullptr;  }
+    /// true if the result is available
+    bool ready() const {  return _state && _state->ready();  }
+    /// wait until the result is available
+    void wait() {  _state->pool->wait_for(_state->counter);  }
+    /// wait for the result and get it; an exception thrown by the job is rethrown here
+    T get() {
+        wait();
+        Releaser releaser{_state};
+        _state = nullptr;
+        if (releaser.state->exception)
+            std::rethrow_exception(releaser.state->exception);
+        return releaser.state->storage.take();
+    }
+    /// run fn on the result as a job, when it is available: fn(T), or fn() if T is void. If the job producing the
+    /// result has thrown, fn is not called and the exception is forwarded to the returned future.
+    /// \return the future of the result of fn
+    template <typename F>
+    Future<typename detail::ContinuationResult<F,T>::type> then(F &&fn, JobPriority priority=JobPriority::NORMAL) {
+        typedef typename detail::ContinuationResult<F,T>::type R;
+        // the reference of this future moves to the continuation
+        auto dst = detail::FutureState<R>::create(*_state->pool,2);
+        auto src = _state;
+        _state = nullptr;
+        src->set_continuation(Job(detail::ThenJob<T,R,typename std::decay<F>::type>{src,dst,std::forward<F>(fn)}),priority);
+        return detail::FutureAccess::make(dst);
+    }
+
+private:
+    friend struct detail::FutureAccess;
+
+    struct Releaser {
+        detail::FutureState<T> *state;
+        ~Releaser() {  state->release();  }
+    };
+
+    explicit Future(detail::FutureState<T> *state)
+    : _state(state) {}
+
+    detail::FutureState<T> *_state;
+};
+
+
+/// \struct WhenAnyResult
+/// \brief result of when_any(): the futures, and the index of the first one that became ready
+/// \details the futures that were not ready can be waited for, but not continued with then().
+template <typename T>
+struct WhenAnyResult {
+    size_t                 index;
+    std::vector<Future<T>> futures;
+};
+
+
+/// run fn() as a job of the pool
+/// \return the future of the result of fn
+template <typename F>
+Future<typename detail::ResultOf<F>::type> submit(BasicThreadPool &pool, F &&fn, JobPriority priority=JobPriority::NORMAL);
+
+/// wait for all the futures, as a job of the pool
+/// \return a future of the results, in the order of the futures (or of nothing, for void futures). If some
+/// futures fail, it fails with the exception of the first of them.
+template <typename T>
+Future<typename detail::WhenAllCollect<T>::Result> when_all(BasicThreadPool &pool, std::vector<Future<T>> futures);
+
+/// wait for the first future that becomes ready
+/// \return a future of the futures and of the index of the first ready one (SIZE_MAX if there are no futures)
+template <typename T>
+Future<WhenAnyResult<T>> when_any(BasicThreadPool &pool, std::vector<Future<T>> futures);
+
+
+
+// template functions implementation
+
+namespace detail {
+
+    template <typename T>
+    struct WhenAllCollect {
+        typedef std::vector<T> Result;
+
+        static Result collect(std::vector<Future<T>> &futures) {
+            Result results;
+            results.reserve(futures.size());
+            for (auto &f: futures)
+                results.push_back(FutureAccess::state(f)->storage.take());
+            return results;
+        }
+    };
+
+    template <>
+    struct WhenAllCollect<void> {
+        typedef void Result;
+
+        static void collect(std::vector<Future<void>>&) {}
+    };
+
+    template <typename T>
+    struct WhenAllData {
+        std::atomic<size_t>                                   remaining;
+        std::vector<Future<T>>                                futures;
+        FutureState<typename WhenAllCollect<T>::Result>      *dst;
+
+        typename WhenAllCollect<T>::Result operator()() {  return WhenAllCollect<T>::collect(futures);  }
+    };
+
+    /// continuation of each future of a when_all: the last one completes the result
+    template <typename T>
+    struct WhenAllJob {
+        WhenAllData<T> *data;
+
+        void operator()() {
+            if (--data->remaining>0)
+                return;
+            std::exception_ptr exception;
+            for (auto &f: data->futures)
+                if (!exception)
+                    exception = FutureAccess::state(f)->exception;
+            if (exception)
+                data->dst->fail(exception);
+            else
+                data->dst->run(*data);
+            data->dst->release();
+            delete data;
+        }
+    };
+
+    template <typename T>
+    struct WhenAnyData {
+        std::atomic<size_t>               remaining;
+        std::atomic<bool>                 done;
+        std::vector<Future<T>>            futures;
+        FutureState<WhenAnyResult<T>>    *dst;
+
+        /// complete the result, if not done yet
+        void complete(size_t index) {
+            if (done.exchange(true))
+                return;
+            auto result = [this,index]() {  return WhenAnyResult<T>{index,std::move(futures)};  };
+            dst->run(result);
+            dst->release();
+        }
+        void release() {
+            if (--remaining==0)
+                delete this;
+        }
+    };
+
+    /// continuation of each future of a when_any: the first one completes the result
+    template <typename T>
+    struct WhenAnyJob {
+        WhenAnyData<T> *data;
+        size_t          index;
+
+        void operator()() {
+            data->complete(index);
+            data->release();
+        }
+    };
+
+} // namespace detail
+
+
+template <typename F>
+Future<typename detail::ResultOf<F>::type> submit(BasicThreadPool &pool, F &&fn, JobPriority priority) {
+    typedef typename detail::ResultOf<F>::type R;
+    // one reference for the future, one for the job
+    auto state = detail::FutureState<R>::create(pool,2);
+    pool.add_job(Job(detail::SubmitJob<R,typename std::decay<F>::type>{state,std::forward<F>(fn)}),nullptr,priority);
+    return detail::FutureAccess::make(state);
+}
+
+template <typename T>
+Future<typename detail::WhenAllCollect<T>::Result> when_all(BasicThreadPool &pool, std::vector<Future<T>> futures) {
+    auto dst = detail::FutureState<typename detail::WhenAllCollect<T>::Result>::create(pool,2);
+    auto data = new detail::WhenAllData<T>();
+    data->remaining = futures.size()+1;
+    data->futures = std::move(futures);
+    data->dst = dst;
+    for (auto &f: data->futures)
+        detail::FutureAccess::state(f)->set_continuation(Job(detail::WhenAllJob<T>{data}),JobPriority::NORMAL);
+    // the extra count keeps the data alive until all the continuations are set
+    detail::WhenAllJob<T>{data}();
+    return detail::FutureAccess::make(dst);
+}
+
+template <typename T>
+Future<WhenAnyResult<T>> when_any(BasicThreadPool &pool, std::vector<Future<T>> futures) {
+    auto dst = detail::FutureState<WhenAnyResult<T>>::create(pool,2);
+    // the states are collected first: the first continuation moves the futures to the result
+    std::vector<detail::FutureState<T>*> states;
+    for (auto &f: futures)
+        states.push_back(detail::FutureAccess::state(f));
+    auto data = new detail::WhenAnyData<T>();
+    data->remaining = futures.size()+1;
+    data->done = false;
+    data->futures = std::move(futures);
+    data->dst = dst;
+    for (size_t i=0; i<states.size(); i++)
+        states[i]->set_continuation(Job(detail::WhenAnyJob<T>{data,i}),JobPriority::NORMAL);
+    // with no futures the result is ready now
+    if (states.empty())
+        data->complete(SIZE_MAX);
+    data->release();
+    return detail::FutureAccess::make(dst);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "threadpool.h"
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+/// \file parallel.h
+/// \brief data-parallel loops on top of the thread pools
+/// \details the ranges are split with lazy binary splitting: a worker processing a range splits it in two halves
+/// only when its own queue is empty (i.e. there is no work that idle workers could steal), and keeps on processing
+/// chunks of `grain` elements otherwise. The pools must be active; with no workers the loops run serially.
+
+
+/// call fn(i) for every i in [begin,end)
+/// \details the calling thread waits until all the iterations are done; workers help executing the jobs.
+template <typename F>
+void parallel_for(BasicThreadPool &pool, int64_t begin, int64_t end, int64_t grain, const F &fn);
+
+/// call fn(b,e) for disjoint sub-ranges covering [begin,end), each at least `grain` elements long (except the last)
+template <typename F>
+void parallel_for_range(BasicThreadPool &pool, int64_t begin, int64_t end, int64_t grain, const F &fn);
+
+/// reduce the values fn(i) for every i in [begin,end) with the binary operation op
+/// \details op must be associative and commutative and identity must be its identity element: the values are
+/// accumulated per worker in no particular order.
+/// \return the reduction, identity if the range is empty
+template <typename T, typename F, typename Op>
+T parallel_reduce(BasicThreadPool &pool, int64_t begin, int64_t end, int64_t grain, const T &identity, const F &fn, const Op &op);
+
+
+
+// template functions implementation
+
+namespace detail {
+
+    template <typename Body>
+    struct RangeContext {
+        BasicThreadPool *pool;
+        const Body      *body;
+        int64_t          grain;
+        JobCounter       counter; ///< jobs created splitting the range
+
+        RangeContext(BasicThreadPool *range_pool, const Body *range_body, int64_t range_grain)
+        : pool(range_pool), body(range_body), grain(range_grain) {}
+    };
+
+    template <typename Body>
+    struct RangeJobData {
+        RangeContext<Body> *ctx;
+        int64_t             begin;
+        int64_t             end;
+    };
+
+    template <typename Body>
+    void range_job(Job *job);
+
+    template <typename Body>
+    void run_range(RangeContext<Body> &ctx, int64_t begin, int64_t end) {
+        while (end-begin>ctx.grain) {
+            if (ctx.pool->local_open_jobs()==0) {
+                // nothing to steal from this worker: give away the second half
+                int64_t mid = begin+(end-begin)/2;
+                RangeJobData<Body> data {&ctx,mid,end};
+                ctx.pool->add_job(Job(range_job<Body>,data),&ctx.counter);
+                end = mid;
+            } else {
+                (*ctx.body)(begin,begin+ctx.grain);
+                begin += ctx.grain;
+            }
+        }
+        (*ctx.body)(begin,end);
+    }
+
+    template <typename Body>
+    void range_job(Job *job) {
+        // copy the arguments out of the local data
+        RangeJobData<Body> data;
+        memcpy(&data,job->local_data,sizeof(data));
+        run_range(*data.ctx,data.begin,data.end);
+    }
+
+    template <typename Body>
+    void parallel_range(BasicThreadPool &pool, int64_t begin, int64_t end, int64_t grain, const Body &body) {
+        if (end<=begin)
+            return;
+        grain = std::max<int64_t>(grain,1);
+        if (pool.max_workers()==0 || end-begin<=grain) {
+            body(begin,end);
+            return;
+        }
+        RangeContext<Body> ctx(&pool,&body,grain);
+        if (pool.current_worker()!=UINT32_MAX) {
+            run_range(ctx,begin,end);
+        } else {
+            RangeJobData<Body> data {&ctx,begin,end};
+            pool.add_job(Job(range_job<Body>,data),&ctx.counter);
+        }
+        pool.wait_for(ctx.counter);
+    }
+
+    /// per-thread partial result, padded to avoid false sharing
+    template <typename T>
+    struct PartialResult {
+        T    value;
+        char pad[CACHE_LINE_SIZE];
+
+        explicit PartialResult(const T &initial_value)
+        : value(initial_value) {}
+    };
+}
+
+template <typename F>
+void parallel_for_range(BasicThreadPool &pool, int64_t begin, int64_t end, int64_t grain, const F &fn) {
+    detail::parallel_range(pool,begin,end,grain,fn);
+}
+
+template <typename F>
+void parallel_for(BasicThreadPool &pool, int64_t begin, int64_t end, int64_t grain, const F &fn) {
+    auto body = [&fn](int64_t b, int64_t e) {
+        for (int64_t i=b; i<e; i++)
+            fn(i);
+    };
+    detail::parallel_range(pool,begin,end,grain,body);
+}
+
+template <typename T, typename F, typename Op>
+T parallel_reduce(BasicThreadPool &pool, int64_t begin, int64_t end, int64_t grain, const T &identity, const F &fn, const Op &op) {
+    // one accumulator per worker, plus one for the calling thread
+    std::vector<detail::PartialResult<T>> partials(pool.max_workers()+1,detail::PartialResult<T>(identity));
+    auto body = [&](int64_t b, int64_t e) {
+        T acc = identity;
+        for (int64_t i=b; i<e; i++)
+            acc = op(acc,fn(i));
+        // fn may help executing other chunks on this worker: merge only at the end
+        auto w = pool.current_worker();
+        auto &partial = partials[w!=UINT32_MAX ? w : partials.size()-1].value;
+        partial = op(partial,acc);
+    };
+    detail::parallel_range(pool,begin,end,grain,body);
+    T result = identity;
+    for (auto &p: partials)
+        result = op(result,p.value);
+    return result;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+
+/// \class Semaphore
+/// \brief counting semaphore, used to park and wake up a single thread
+class Semaphore {
+public:
+    explicit Semaphore(int count=0)
+    : _count(count) {}
+    Semaphore(const Semaphore&) = delete;
+
+    /// increase the count, waking up a waiting thread
+    void post() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _count++;
+        _cv.notify_one();
+    }
+    /// wait until the count is positive, then decrease it
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock,[&]{ return _count>0; });
+        _count--;
+    }
+    /// wait until the count is positive, then decrease it, or until the timeout expires
+    /// \return false on timeout
+    template <typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep,Period> &timeout) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_cv.wait_for(lock,timeout,[&]{ return _count>0; }))
+            return false;
+        _count--;
+        return true;
+    }
+
+private:
+    std::mutex              _mutex;
+    std::condition_variable _cv;
+    int                     _count;
+};
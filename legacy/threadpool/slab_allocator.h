@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+
+/// \class SlabAllocator
+/// \brief recycling allocator of small blocks, with per-thread free lists
+/// \details the sizes are rounded up to multiples of granularity bytes (one cache line). Released blocks are kept
+/// in the free list of the releasing thread and reused by its next allocations of the same size class, so the
+/// workers allocate and release job storage and coroutine frames without locks and, in steady state, without
+/// touching the heap. A block can be released by any thread. Blocks larger than max_size use the global allocator.
+class SlabAllocator {
+public:
+    static const size_t granularity = 64;
+    static const size_t max_size = 2048;
+    static const size_t max_cached = 256;   ///< blocks kept per size class and per thread
+
+    static void* allocate(size_t size) {
+        if (size>max_size)
+            return ::operator new(size);
+        auto &l = lists();
+        size_t c = size_class(size);
+        if (void *ptr = l.heads[c]) {
+            l.heads[c] = *static_cast<void**>(ptr);
+            l.counts[c]--;
+            return ptr;
+        }
+        return ::operator new((c+1)*granularity);
+    }
+    static void deallocate(void *ptr, size_t size) {
+        if (size>max_size) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto &l = lists();
+        size_t c = size_class(size);
+        if (l.counts[c]>=max_cached) {
+            ::operator delete(ptr);
+            return;
+        }
+        *static_cast<void**>(ptr) = l.heads[c];
+        l.heads[c] = ptr;
+        l.counts[c]++;
+    }
+
+private:
+    static const size_t num_classes = max_size/granularity;
+
+    struct FreeLists {
+        void   *heads[num_classes];
+        size_t  counts[num_classes];
+
+        FreeLists() {
+            for (size_t c=0; c<num_classes; c++) {
+                heads[c] = nullptr;
+                counts[c] = 0;
+            }
+        }
+        ~FreeLists() {
+            for (auto head: heads) {
+                while (head) {
+                    void *next = *static_cast<void**>(head);
+                    ::operator delete(head);
+                    head = next;
+                }
+            }
+        }
+    };
+
+    static size_t size_class(size_t size) {  return size>0 ? (size-1)/granularity : 0;  }
+    static FreeLists& lists() {
+        static thread_local FreeLists l;
+        return l;
+    }
+};
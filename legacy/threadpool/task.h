@@ -0,0 +1,283 @@
+#pragma once
+
+#include "threadpool.h"
+#include "slab_allocator.h"
+
+#if THREADPOOL_HAS_COROUTINES
+
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace detail {
+
+/// \struct PromiseBase
+/// \brief state shared by the promises of all the tasks: frame allocation, continuation and exception
+struct PromiseBase {
+    std::coroutine_handle<> continuation; ///< coroutine awaiting the task
+    std::exception_ptr      exception;
+
+    static void* operator new(size_t size) {  return SlabAllocator::allocate(size);  }
+    static void operator delete(void *ptr, size_t size) {  SlabAllocator::deallocate(ptr,size);  }
+
+    /// resume the awaiting coroutine without growing the stack
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {  return false;  }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+            auto c = handle.promise().continuation;
+            return c ? c : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept {  return {};  }
+    FinalAwaiter final_suspend() const noexcept {  return {};  }
+    void unhandled_exception() {  exception = std::current_exception();  }
+};
+
+template <typename T>
+struct TaskPromise: PromiseBase {
+    std::optional<T> value;
+
+    void return_value(T v) {  value.emplace(std::move(v));  }
+    T result() {
+        if (exception)
+            std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void>: PromiseBase {
+    void return_void() {}
+    void result() {
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+} // namespace detail
+
+
+/// \class Task
+/// \brief lazily started coroutine producing a value of type T
+/// \details a task starts when awaited, and resumes the awaiting coroutine when it completes. It runs on the thread
+/// that resumes it: co_await pool.schedule() moves it to the workers of a pool. Frames are allocated from the
+/// SlabAllocator, so a suspended task costs no heap allocation in steady state. Exceptions are propagated to the
+/// awaiting coroutine.
+template <typename T=void>
+class Task {
+public:
+    struct promise_type: detail::TaskPromise<T> {
+        Task get_return_object() {  return Task(std::coroutine_handle<promise_type>::from_promise(*this));  }
+    };
+
+    Task() = default;
+    Task(Task &&other) noexcept
+    : _handle(std::exchange(other._handle,nullptr)) {}
+    Task& operator=(Task &&other) noexcept {
+        if (this!=&other) {
+            if (_handle)
+                _handle.destroy();
+            _handle = std::exchange(other._handle,nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    ~Task() {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    /// true if the task has completed
+    bool done() const {  return !_handle || _handle.done();  }
+
+    /// start the task and suspend the awaiting coroutine until it completes
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept {  return !handle || handle.done();  }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() {  return handle.promise().result();  }
+        };
+        return Awaiter{_handle};
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle)
+    : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+
+namespace detail {
+
+/// \struct DetachedTask
+/// \brief eagerly started coroutine that destroys itself when complete
+struct DetachedTask {
+    struct promise_type: PromiseBase {
+        DetachedTask get_return_object() const noexcept {  return {};  }
+        std::suspend_never initial_suspend() const noexcept {  return {};  }
+        std::suspend_never final_suspend() const noexcept {  return {};  }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept {  std::terminate();  }
+    };
+};
+
+/// \struct CounterAwaiter
+/// \brief awaitable suspending the coroutine until all the jobs of a counter are complete
+struct CounterAwaiter {
+    JobCounter *counter;
+
+    bool await_ready() const noexcept {  return counter->done();  }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        counter->continuation = &BasicThreadPool::resume_coroutine;
+        counter->continuation_data = handle.address();
+        // publish the continuation: if the jobs completed in the meantime the coroutine continues immediately
+        if ((counter->value.fetch_add(JobCounter::awaited_flag) & ~JobCounter::awaited_flag)==0) {
+            counter->value.fetch_sub(JobCounter::awaited_flag);
+            return false;
+        }
+        return true;
+    }
+    void await_resume() const noexcept {}
+};
+
+/// \struct WhenAllState
+/// \brief number of running tasks of a when_all, plus one held by the awaiting coroutine until it is suspended
+struct WhenAllState {
+    std::atomic<size_t>     remaining;
+    std::coroutine_handle<> continuation;
+
+    explicit WhenAllState(size_t num_tasks)
+    : remaining(num_tasks+1) {}
+
+    void complete() {
+        if (--remaining==0)
+            continuation.resume();
+    }
+
+    bool await_ready() const noexcept {  return false;  }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        continuation = handle;
+        return --remaining>0;
+    }
+    void await_resume() const noexcept {}
+};
+
+template <typename T>
+using TaskResult = std::conditional_t<std::is_void<T>::value,char,std::optional<T>>;
+
+/// \struct SyncWaitState
+/// \brief completion flag of a task awaited by a thread that is not a coroutine
+struct SyncWaitState {
+    std::mutex              mutex;
+    std::condition_variable cv;
+    bool                    done = false;
+
+    void complete() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_all();
+    }
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock,[&]{ return done; });
+    }
+};
+
+/// run a task on a worker of the pool, storing its result or its exception, then call state.complete()
+template <typename T, typename State>
+DetachedTask run_task(BasicThreadPool &pool, Task<T> &task, TaskResult<T> &result, std::exception_ptr &exception, State &state) {
+    co_await pool.schedule();
+    try {
+        if constexpr (std::is_void<T>::value)
+            co_await task;
+        else
+            result.emplace(co_await task);
+    } catch (...) {
+        exception = std::current_exception();
+    }
+    state.complete();
+}
+
+template <typename T>
+struct WhenAllResults {
+    std::vector<TaskResult<T>>      results;
+    std::vector<std::exception_ptr> exceptions;
+
+    WhenAllResults(BasicThreadPool &pool, std::vector<Task<T>> &tasks, WhenAllState &state)
+    : results(tasks.size()), exceptions(tasks.size()) {
+        for (size_t i=0; i<tasks.size(); i++)
+            run_task(pool,tasks[i],results[i],exceptions[i],state);
+    }
+    /// rethrow the first exception, if any
+    void check() const {
+        for (auto &e: exceptions)
+            if (e)
+                std::rethrow_exception(e);
+    }
+};
+
+} // namespace detail
+
+
+/// suspend the coroutine until all the jobs referencing the counter are complete: co_await counter.
+/// The coroutine is resumed by a job submitted by the worker completing the last job. A counter can be awaited
+/// by one coroutine at a time.
+inline detail::CounterAwaiter operator co_await(JobCounter &counter) {
+    return detail::CounterAwaiter{&counter};
+}
+
+/// run the tasks concurrently on the workers of the pool
+/// \return the results, in the order of the tasks
+template <typename T>
+Task<std::vector<T>> when_all(BasicThreadPool &pool, std::vector<Task<T>> tasks) {
+    detail::WhenAllState state(tasks.size());
+    detail::WhenAllResults<T> r(pool,tasks,state);
+    co_await state;
+    r.check();
+    std::vector<T> results;
+    results.reserve(tasks.size());
+    for (auto &v: r.results)
+        results.push_back(std::move(*v));
+    co_return results;
+}
+
+/// run the tasks concurrently on the workers of the pool
+inline Task<void> when_all(BasicThreadPool &pool, std::vector<Task<void>> tasks) {
+    detail::WhenAllState state(tasks.size());
+    detail::WhenAllResults<void> r(pool,tasks,state);
+    co_await state;
+    r.check();
+}
+
+/// run a task on the pool and block the calling thread until it completes. Must not be called from a worker.
+/// \return the result of the task
+template <typename T>
+T sync_wait(BasicThreadPool &pool, Task<T> task) {
+    detail::SyncWaitState state;
+    detail::TaskResult<T> result;
+    std::exception_ptr exception;
+    detail::run_task(pool,task,result,exception,state);
+    state.wait();
+    if (exception)
+        std::rethrow_exception(exception);
+    if constexpr (!std::is_void<T>::value)
+        return std::move(*result);
+}
+
+#endif
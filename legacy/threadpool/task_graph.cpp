@@ -0,0 +1,180 @@
+#include "task_graph.h"
+
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+
+uint32_t TaskGraph::add_node(const Task &task) {
+    _nodes.push_back(Node {task,{}});
+    _durations.push_back(0);
+    _priorities.push_back(0);
+    _compiled = false;
+    return _nodes.size()-1;
+}
+
+void TaskGraph::add_edge(uint32_t from, uint32_t to) {
+    _nodes[from].successors.push_back(to);
+    _compiled = false;
+}
+
+bool TaskGraph::compile() {
+    uint32_t n = _nodes.size();
+    _initial_counters.assign(n,0);
+    for (auto &node: _nodes)
+        for (auto s: node.successors)
+            _initial_counters[s]++;
+    // flatten the successor lists
+    _successor_offsets.assign(n+1,0);
+    _successors.clear();
+    for (uint32_t i=0; i<n; i++) {
+        _successor_offsets[i] = _successors.size();
+        _successors.insert(_successors.end(),_nodes[i].successors.begin(),_nodes[i].successors.end());
+    }
+    _successor_offsets[n] = _successors.size();
+    // topological sort (Kahn)
+    _roots.clear();
+    _order.clear();
+    std::vector<int32_t> counters = _initial_counters;
+    for (uint32_t i=0; i<n; i++)
+        if (counters[i]==0)
+            _roots.push_back(i);
+    _order = _roots;
+    for (uint32_t k=0; k<_order.size(); k++) {
+        uint32_t i = _order[k];
+        for (uint32_t j=_successor_offsets[i]; j<_successor_offsets[i+1]; j++)
+            if (--counters[_successors[j]]==0)
+                _order.push_back(_successors[j]);
+    }
+    _counters.reset(new std::atomic<int32_t>[n]);
+    // with a cycle some nodes are never ready
+    _compiled = _order.size()==n;
+    return _compiled;
+}
+
+bool TaskGraph::launch(BasicThreadPool &pool, const CancellationToken *token) {
+    if (!_compiled && !compile())
+        return false;
+    _pool = &pool;
+    _token = token;
+    // without workers the nodes are executed by the calling thread
+    if (pool.max_workers()==0) {
+        for (auto i: _order)
+            if (_nodes[i].task && !(token && token->is_cancelled()))
+                _nodes[i].task();
+        return true;
+    }
+    for (uint32_t i=0; i<_nodes.size(); i++)
+        _counters[i].store(_initial_counters[i],std::memory_order_relaxed);
+    if (_policy==TaskGraphPolicy::FIFO) {
+        for (auto r: _roots)
+            pool.add_job(Job(node_job,NodeJobData {this,r}),&_pending,JobPriority::NORMAL,token);
+        return true;
+    }
+    // each ready_job executes the best ready node when it starts, not a predetermined one
+    compute_priorities();
+    _ready.clear();
+    for (auto r: _roots)
+        _ready.push_back(std::make_pair(_priorities[r],r));
+    std::make_heap(_ready.begin(),_ready.end());
+    for (uint32_t i=0; i<_roots.size(); i++)
+        pool.add_job(Job(ready_job,NodeJobData {this,UINT32_MAX}),&_pending,JobPriority::NORMAL,token);
+    return true;
+}
+
+void TaskGraph::compute_priorities() {
+    // nodes never executed count as 1ns, so that the priority of unmeasured graphs is the longest path
+    for (auto k=_order.size(); k-->0;) {
+        uint32_t i = _order[k];
+        int64_t longest = 0;
+        for (uint32_t j=_successor_offsets[i]; j<_successor_offsets[i+1]; j++)
+            longest = std::max(longest,_priorities[_successors[j]]);
+        _priorities[i] = std::max<int64_t>(_durations[i],1) + longest;
+    }
+}
+
+uint32_t TaskGraph::pop_ready() {
+    std::unique_lock<std::mutex> lock(_ready_mutex);
+    std::pop_heap(_ready.begin(),_ready.end());
+    uint32_t node = _ready.back().second;
+    _ready.pop_back();
+    return node;
+}
+
+void TaskGraph::wait() {
+    if (_pool)
+        _pool->wait_for(_pending);
+}
+
+bool TaskGraph::run(BasicThreadPool &pool, const CancellationToken *token) {
+    if (!launch(pool,token))
+        return false;
+    wait();
+    return true;
+}
+
+void TaskGraph::node_job(Job *job) {
+    // copy the arguments out of the local data
+    NodeJobData data;
+    memcpy(&data,job->local_data,sizeof(data));
+    // the last ready successor is executed directly by this job, without going through the queues
+    uint32_t node = data.node;
+    while (node!=UINT32_MAX)
+        node = data.graph->execute_node(node);
+}
+
+void TaskGraph::ready_job(Job *job) {
+    NodeJobData data;
+    memcpy(&data,job->local_data,sizeof(data));
+    // there is a ready node for every ready_job submitted
+    uint32_t node = data.graph->pop_ready();
+    while (node!=UINT32_MAX)
+        node = data.graph->execute_node(node);
+}
+
+uint32_t TaskGraph::execute_node(uint32_t node) {
+    // cancelled execution: the successors are never ready
+    if (_token && _token->is_cancelled())
+        return UINT32_MAX;
+    auto start = std::chrono::steady_clock::now();
+    if (_nodes[node].task)
+        _nodes[node].task();
+    // exponential moving average of the duration; each node is executed by one thread per launch
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+    int64_t &duration = _durations[node];
+    duration = duration==0 ? elapsed : duration + (elapsed-duration)/4;
+    if (_policy==TaskGraphPolicy::FIFO) {
+        uint32_t next = UINT32_MAX;
+        for (uint32_t j=_successor_offsets[node]; j<_successor_offsets[node+1]; j++) {
+            uint32_t s = _successors[j];
+            if (--_counters[s]==0) {
+                if (next!=UINT32_MAX)
+                    _pool->add_job(Job(node_job,NodeJobData {this,next}),&_pending,JobPriority::NORMAL,_token);
+                next = s;
+            }
+        }
+        return next;
+    }
+    // critical path: queue the ready successors, keep on running the best ready node
+    uint32_t num_ready = 0;
+    uint32_t next = UINT32_MAX;
+    {
+        std::unique_lock<std::mutex> lock(_ready_mutex);
+        for (uint32_t j=_successor_offsets[node]; j<_successor_offsets[node+1]; j++) {
+            uint32_t s = _successors[j];
+            if (--_counters[s]==0) {
+                _ready.push_back(std::make_pair(_priorities[s],s));
+                std::push_heap(_ready.begin(),_ready.end());
+                num_ready++;
+            }
+        }
+        if (num_ready>0) {
+            std::pop_heap(_ready.begin(),_ready.end());
+            next = _ready.back().second;
+            _ready.pop_back();
+        }
+    }
+    for (uint32_t i=1; i<num_ready; i++)
+        _pool->add_job(Job(ready_job,NodeJobData {this,UINT32_MAX}),&_pending,JobPriority::NORMAL,_token);
+    return next;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "threadpool.h"
+
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+/// \enum TaskGraphPolicy
+/// \brief order of execution of the ready nodes of a TaskGraph
+enum class TaskGraphPolicy {
+    FIFO = 0,      ///< ready nodes are submitted to the pool as soon as they are ready
+    CRITICAL_PATH  ///< ready nodes are executed in order of bottom level (longest path to the end of the graph)
+};
+
+/// \class TaskGraph
+/// \brief graph of tasks with dependencies, built once and executed many times
+/// \details nodes and edges are declared once; compile() sorts the graph topologically and precomputes the
+/// successor lists and the initial number of predecessors of every node. Each launch() resets the counters in
+/// O(nodes) and schedules the root nodes directly: a completed node decreases the counters of its successors and
+/// schedules the ones that become ready, without any lock or locked job.\n
+/// The duration of every node is measured and averaged over the executions. With the CRITICAL_PATH policy (the
+/// default) each launch computes the bottom level of the nodes (the duration of the longest path from the node to
+/// the end of the graph) and the ready nodes are kept in a priority queue: a worker always picks the ready node with
+/// the highest bottom level, so that the long chains start as early as possible.\n
+/// An execution can be cancelled with the token given to launch(): the nodes not started yet are skipped.\n
+/// A graph can run only once at a time; the tasks must not modify the graph.
+class TaskGraph {
+public:
+    typedef std::function<void()> Task;
+
+    TaskGraph() = default;
+    TaskGraph(const TaskGraph&) = delete;
+
+    /// add a node
+    /// \return the index of the node
+    uint32_t add_node(const Task &task);
+    /// add a dependency: the node `to` is executed after the node `from` is complete
+    void add_edge(uint32_t from, uint32_t to);
+    /// number of nodes
+    uint32_t size() const {  return _nodes.size();  }
+
+    /// precompute the execution data. Called by launch() if the graph has been modified.
+    /// \return false if the graph contains a cycle
+    bool compile();
+    /// topological order of the nodes, computed by compile()
+    const std::vector<uint32_t>& order() const {  return _order;  }
+
+    /// set the order of execution of the ready nodes
+    void set_policy(TaskGraphPolicy policy) {  _policy = policy;  }
+    TaskGraphPolicy policy() const {  return _policy;  }
+    /// average measured duration of a node, in ns (0 if never executed)
+    int64_t duration(uint32_t node) const {  return _durations[node];  }
+    /// priority of a node in the last launch (bottom level, in ns)
+    int64_t priority(uint32_t node) const {  return _priorities[node];  }
+
+    /// start the execution of the graph on the pool. If the token is cancelled, the nodes not started are skipped.
+    /// \return false if the graph can't be compiled
+    bool launch(BasicThreadPool &pool, const CancellationToken *token=nullptr);
+    /// wait until the launched execution is complete; workers help executing jobs while waiting
+    void wait();
+    /// launch the graph and wait for its completion
+    bool run(BasicThreadPool &pool, const CancellationToken *token=nullptr);
+    /// true if no execution is in progress
+    bool done() const {  return _pending.done();  }
+
+private:
+    struct Node {
+        Task                  task;
+        std::vector<uint32_t> successors;
+    };
+    struct NodeJobData {
+        TaskGraph *graph;
+        uint32_t   node;
+    };
+
+    /// job executing a node and the successors that become ready
+    static void node_job(Job *job);
+    /// job executing the ready node with the highest priority and the successors that become ready
+    static void ready_job(Job *job);
+    /// run a node; return the index of a ready node to run next, UINT32_MAX if none
+    uint32_t execute_node(uint32_t node);
+    /// compute the bottom levels of the nodes from their durations
+    void compute_priorities();
+    /// extract the ready node with the highest priority
+    uint32_t pop_ready();
+
+    std::vector<Node>                       _nodes;
+    bool                                    _compiled = false;
+    // compiled data
+    std::vector<uint32_t>                   _order;             ///< topological order
+    std::vector<uint32_t>                   _roots;             ///< nodes without predecessors
+    std::vector<uint32_t>                   _successor_offsets; ///< successors of node i: [_successor_offsets[i],_successor_offsets[i+1])
+    std::vector<uint32_t>                   _successors;
+    std::vector<int32_t>                    _initial_counters;  ///< number of predecessors of each node
+    std::unique_ptr<std::atomic<int32_t>[]> _counters;          ///< unfinished predecessors in the current execution
+    std::vector<int64_t>                    _durations;         ///< moving average of the node durations, in ns
+    std::vector<int64_t>                    _priorities;        ///< bottom levels of the nodes
+    // execution data
+    TaskGraphPolicy                         _policy = TaskGraphPolicy::CRITICAL_PATH;
+    std::vector<std::pair<int64_t,uint32_t>> _ready;            ///< heap of the ready nodes and their priority
+    std::mutex                              _ready_mutex;
+    BasicThreadPool                        *_pool = nullptr;
+    const CancellationToken                *_token = nullptr;   ///< cancellation of the current execution
+    JobCounter                              _pending;           ///< jobs of the current execution
+};
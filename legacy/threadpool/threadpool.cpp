@@ -1,182 +1,1161 @@
+
 #include "threadpool.h"
+#include "tracing/tracing.h"
+
+#include <new>
+#include <chrono>
+#include <initializer_list>
 
 // local variables and functions
 namespace {
+
+// pool and index of the worker running on the current thread, and the fiber it is running
+thread_local const BasicThreadPool *tls_pool = nullptr;
+thread_local unsigned int           tls_worker_idx = UINT32_MAX;
+thread_local void                  *tls_fiber = nullptr;
+
+// a parked fiber can be resumed on another thread: the functions reading the thread local variables must not be
+// inlined, otherwise the compiler could reuse the addresses computed on the previous thread
+#if defined(__GNUC__)
+#define THREADPOOL_NOINLINE __attribute__((noinline))
+#else
+#define THREADPOOL_NOINLINE
+#endif
+
+// hint to the cpu that the thread is spinning
+inline void cpu_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// increase a statistic counter. The counters have a single writer: a relaxed load and store are enough
+inline void add_stat(std::atomic<uint64_t> &stat, uint64_t value) {
+    stat.store(stat.load(std::memory_order_relaxed)+value,std::memory_order_relaxed);
+}
+
+// id of the flow events linking a job to the job that submitted it
+inline int flow_id(ID job_id) {
+    return (int)(job_id.index ^ (job_id.internal_id<<20));
+}
+
+// xorshift random generator, used to pick the victims of the steals
+inline uint32_t next_random(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+}
+
+
+
+
+JobRing::JobRing()
+: _cursor(0) {
+    // the jobs must be aligned to the cache lines, to avoid false sharing
+    _block = new char[job_ring_size*sizeof(Job)+CACHE_LINE_SIZE];
+    _jobs = reinterpret_cast<Job*>(_block + (CACHE_LINE_SIZE - reinterpret_cast<uintptr_t>(_block)%CACHE_LINE_SIZE)%CACHE_LINE_SIZE);
+    for (uint32_t i=0; i<job_ring_size; i++) {
+        new(&_jobs[i]) Job();
+        _generations[i] = 0;
+    }
+}
+
+JobRing::~JobRing() {
+    delete[] _block;
+}
+
+uint32_t JobRing::allocate() {
+    // the slots are released roughly in allocation order: the slot after the last allocated one is usually free
+    for (uint32_t i=0; i<job_ring_size; i++) {
+        uint32_t slot = (_cursor+i) & (job_ring_size-1);
+        uint32_t gen = _generations[slot].load(std::memory_order_acquire);
+        if ((gen&1)==0) {
+            // only the owner moves a slot from free to used
+            _generations[slot].store(gen+1,std::memory_order_relaxed);
+            _cursor = slot+1;
+            return slot;
+        }
+    }
+    return UINT32_MAX;
 }
 
 
 
 
-BasicThreadPool::BasicThreadPool(unsigned int num_worker_threads) {
+BasicThreadPool::BasicThreadPool(unsigned int num_worker_threads)
+: BasicThreadPool(ThreadPoolConfig(num_worker_threads)) {
+}
+
+BasicThreadPool::BasicThreadPool(const ThreadPoolConfig &config)
+: BasicThreadPool(config,true) {
+}
+
+BasicThreadPool::BasicThreadPool(const ThreadPoolConfig &config, bool start_workers)
+: _config(config), _num_rings(0), _num_worker_rings(0), _shared_ring_hint(0), _state(ThreadPoolState::PAUSED), _num_jobs(0), _num_spinning(0),
+  _num_spinning_high(0), _num_parked(0), _num_waiters(0), _num_waiting_fibers(0), _num_active(0), _num_blocked(0),
+  _timers_epoch(std::chrono::steady_clock::now()) {
+    for (auto &r: _rings)
+        r = nullptr;
+    for (auto &n: _num_open_jobs)
+        n = 0;
+    _cleared.cancel();
     // printf("size of Job struct: %lu\n", sizeof(Job));
     // printf("size of Job struct local_data: %lu\n", sizeof(Job::local_data));
     // printf("thread id: %llu\n", thread_id());
     // create the worker threads
-    for (auto i=0; i<num_worker_threads; i++) {
-        // _workers.push_back(std::thread(basic_worker_thread_func, this));
-        _workers.push_back(std::thread(&BasicThreadPool::worker_thread_function,this));
-    }
+    if (start_workers)
+        create_workers();
 }
 
 BasicThreadPool::~BasicThreadPool() {
+    join_workers();
+    // the jobs of the pending timers are never executed
+    _timers.clear([](ID, TimerJob &timer_job) {  timer_job.job.discard();  });
+    for (uint32_t i=0; i<_num_rings; i++)
+        delete _rings[i].load();
+}
+
+void BasicThreadPool::create_workers() {
+    create_worker_data(_config.num_workers);
+    _workers.resize(_worker_data.size());
+    for (unsigned int i=0; i<_config.num_workers; i++)
+        _workers[i] = std::thread(&BasicThreadPool::worker_thread_function,this,i);
+    if (_worker_data.size()>_config.num_workers)
+        _manager = std::thread(&BasicThreadPool::manager_thread_function,this);
+}
+
+void BasicThreadPool::create_worker_data(unsigned int num_worker_threads) {
+    // elastic pools: the slots of the workers added on demand are created now, their rings when used
+    unsigned int num_slots = std::max(num_worker_threads,_config.max_workers);
+    // placement of the workers: one per physical core first, following the topology
+    CpuTopology topology;
+    std::vector<unsigned int> placement;
+    if (_config.pin_workers && num_slots>0) {
+        topology = _config.topology ? *_config.topology : CpuTopology::detect();
+        placement = topology.placement();
+    }
+    for (unsigned int i=0; i<num_slots; i++) {
+        _worker_data.push_back(std::unique_ptr<WorkerData>(new WorkerData()));
+        _worker_data.back()->rng_state = 2654435761u*(i+1);
+        if (!placement.empty()) {
+            _worker_data.back()->cpu = placement[i%placement.size()];
+            _worker_data.back()->node = topology.node_of(_worker_data.back()->cpu);
+        }
+        if (i<num_worker_threads) {
+            _worker_data.back()->live = true;
+            _rings[i] = new JobRing();
+        }
+    }
+    _num_active = num_worker_threads;
+    // shared queues, one set per node
+    _node_queues.clear();
+    for (unsigned int n=0; n<std::max(topology.num_nodes(),1u); n++)
+        _node_queues.push_back(std::unique_ptr<NodeQueues>(new NodeQueues()));
+    _cpu_nodes.clear();
+    for (auto &info: topology.cpus()) {
+        if (info.cpu>=_cpu_nodes.size())
+            _cpu_nodes.resize(info.cpu+1,0);
+        _cpu_nodes[info.cpu] = info.node;
+    }
+    // victims of the steals: the workers of the same node first
+    for (unsigned int i=0; i<num_slots; i++) {
+        auto &worker = *_worker_data[i];
+        for (unsigned int pass=0; pass<2; pass++) {
+            for (unsigned int v=0; v<num_slots; v++) {
+                if (v!=i && (_worker_data[v]->node==worker.node)==(pass==0))
+                    worker.victims.push_back(v);
+            }
+            if (pass==0)
+                worker.num_local_victims = worker.victims.size();
+        }
+    }
+    // the last workers are reserved to the HIGH level; at least one worker serves all the levels
+    unsigned int num_reserved = num_worker_threads>0 ? std::min(_config.num_high_priority_workers,num_worker_threads-1) : 0;
+    for (auto i=num_worker_threads-num_reserved; i<num_worker_threads; i++)
+        _worker_data[i]->high_priority_only = true;
+    _num_worker_rings = num_slots;
+    _num_rings = num_slots;
+    // fibers, if supported by the platform
+    for (unsigned int i=0; _config.use_fibers && num_slots>0 && i<_config.num_fibers; i++) {
+        Fiber *fiber = new Fiber();
+        _fibers.push_back(std::unique_ptr<Fiber>(fiber));
+        fiber->pool = this;
+        if (!fiber->context.create(_config.fiber_stack_size,&BasicThreadPool::fiber_function,fiber)) {
+            _fibers.clear();
+            break;
+        }
+        _free_fibers.push_back(fiber);
+    }
+}
+
+void BasicThreadPool::join_workers() {
     stop();
-    _cv.notify_all();
+    if (_manager.joinable())
+        _manager.join();
+    std::thread timer_thread;
+    {
+        std::unique_lock<std::mutex> lock(_timers_mutex);
+        timer_thread = std::move(_timer_thread);
+    }
+    if (timer_thread.joinable())
+        timer_thread.join();
     for (auto&& w: _workers) {
-        w.join();
+        if (w.joinable())
+            w.join();
     }
     _workers.clear();
 }
 
+void BasicThreadPool::manager_thread_function() {
+    auto grow_delay = std::chrono::microseconds(_config.grow_delay_us);
+    bool backlog = false;
+    auto backlog_start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(_manager_mutex);
+    while (_state!=ThreadPoolState::STOPPED) {
+        _manager_cv.wait_for(lock,std::chrono::microseconds(_config.manager_period_us));
+        if (_state!=ThreadPoolState::ACTIVE) {
+            backlog = false;
+            continue;
+        }
+        uint32_t active = _num_active.load();
+        uint32_t blocked = std::min(_num_blocked.load(),active);
+        uint32_t running = active-blocked;
+        size_t queued = open_jobs();
+        // blocked workers are replaced as long as there are jobs waiting for them
+        bool grow = queued>0 && running<_config.num_workers;
+        // the queued jobs grow faster than the workers can execute them
+        auto now = std::chrono::steady_clock::now();
+        if (queued>(size_t)_config.grow_threshold*std::max(running,1u)) {
+            if (!backlog)
+                backlog_start = now;
+            backlog = true;
+            if (now-backlog_start>=grow_delay) {
+                grow = true;
+                backlog_start = now;
+            }
+        } else {
+            backlog = false;
+        }
+        if (grow)
+            spawn_worker();
+    }
+}
+
+bool BasicThreadPool::spawn_worker() {
+    for (unsigned int i=_config.num_workers; i<_worker_data.size(); i++) {
+        auto &worker = *_worker_data[i];
+        if (worker.live.load())
+            continue;
+        // the previous thread of the slot has exited, or is about to
+        if (_workers[i].joinable())
+            _workers[i].join();
+        worker.retiring = false;
+        worker.num_acquired = 0;
+        // the ring is kept by the next threads of the slot: it can still contain live jobs
+        if (!_rings[i].load())
+            _rings[i] = new JobRing();
+        worker.live = true;
+        _num_active++;
+        _workers[i] = std::thread(&BasicThreadPool::worker_thread_function,this,i);
+        return true;
+    }
+    return false;
+}
+
+void BasicThreadPool::enter_blocking_region() {
+    _num_blocked++;
+    if (_config.max_workers>_config.num_workers)
+        _manager_cv.notify_one();
+}
+
+void BasicThreadPool::leave_blocking_region() {
+    _num_blocked--;
+}
+
 // add a job to the pool
-ID BasicThreadPool::add_job(const Job &job) {
-    ID job_id;
+ID BasicThreadPool::add_job(const Job &job, JobCounter *counter, JobPriority priority, const CancellationToken *token) {
+    ID job_id = allocate_job(job,counter,priority,any_node,token,false);
+    enqueue(job_id);
+    return job_id;
+}
+
+ID BasicThreadPool::add_job_on_node(const Job &job, unsigned int node, JobCounter *counter, JobPriority priority, const CancellationToken *token) {
+    ID job_id = allocate_job(job,counter,priority,node,token,false);
+    enqueue(job_id);
+    return job_id;
+}
+
+void BasicThreadPool::add_jobs(const Job *jobs, size_t count, JobCounter *counter, JobPriority priority, ID *ids, const CancellationToken *token) {
+    if (count==0)
+        return;
+    std::vector<ID> buffer;
+    if (!ids) {
+        buffer.resize(count);
+        ids = buffer.data();
+    }
+    allocate_jobs(jobs,count,counter,priority,any_node,token,false,ids);
+    enqueue(ids,count,(unsigned int)priority);
+}
+
+ID BasicThreadPool::add_job_after(std::chrono::nanoseconds delay, const Job &job, JobCounter *counter, JobPriority priority) {
+    // the counter is held by the timer until the job is submitted
+    if (counter)
+        counter->value++;
+    TimerJob timer_job;
+    timer_job.job = job;
+    timer_job.counter = counter;
+    timer_job.priority = priority;
+    return add_timer(delay,timer_job,std::chrono::nanoseconds(0));
+}
+
+ID BasicThreadPool::add_periodic_job(std::chrono::nanoseconds period, const Job &job, JobPriority priority) {
+    // a callable stored out of line is released by the first execution: the job is dropped
+    if (job.owns_callable()) {
+        Job(job).discard();
+        return ID();
+    }
+    TimerJob timer_job;
+    timer_job.job = job;
+    timer_job.priority = priority;
+    return add_timer(period,timer_job,period);
+}
+
+bool BasicThreadPool::cancel_timer(ID timer_id) {
+    TimerJob timer_job;
+    {
+        std::unique_lock<std::mutex> lock(_timers_mutex);
+        TimerJob *pending = _timers.get(timer_id);
+        if (!pending)
+            return false;
+        timer_job = *pending;
+        _timers.cancel(timer_id);
+    }
+    timer_job.job.discard();
+    if (timer_job.counter)
+        signal(*timer_job.counter);
+    return true;
+}
+
+size_t BasicThreadPool::pending_timers() const {
+    std::unique_lock<std::mutex> lock(_timers_mutex);
+    return _timers.size();
+}
+
+ID BasicThreadPool::add_timer(std::chrono::nanoseconds delay, const TimerJob &timer_job, std::chrono::nanoseconds period) {
+    // deadlines rounded up to whole ticks, so that the jobs are never submitted early
+    int64_t tick = std::max(_config.timer_tick_us,1u)*int64_t(1000);
+    auto to_ticks = [tick](int64_t ns) -> uint64_t {
+        return ns>0 ? ns/tick + (ns%tick!=0) : 0;
+    };
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-_timers_epoch).count();
+    uint64_t now = elapsed/tick;
+    uint64_t deadline = to_ticks(elapsed+std::min(std::max<int64_t>(delay.count(),0),INT64_MAX-elapsed));
+    ID timer_id;
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        job_id = _jobs.add(job);
-        _open_jobs_queue.push_back(job_id);
-        // increase unfinished job count in the parent
-        if (valid(job.parent_id) && _jobs.has(job.parent_id)) {
-            _jobs.get(job.parent_id).unfinished_jobs++;
+        std::unique_lock<std::mutex> lock(_timers_mutex);
+        // an empty wheel is moved to the current tick at once, instead of being turned by the timer thread
+        if (_timers.size()==0)
+            _timers.advance(now,[](ID, TimerJob&) {});
+        timer_id = _timers.add(deadline,timer_job,period.count()>0 ? std::max<uint64_t>(to_ticks(period.count()),1) : 0);
+        if (!_timer_thread.joinable() && _state!=ThreadPoolState::STOPPED)
+            _timer_thread = std::thread(&BasicThreadPool::timer_thread_function,this);
+    }
+    _timers_cv.notify_one();
+    return timer_id;
+}
+
+void BasicThreadPool::timer_thread_function() {
+    std::chrono::nanoseconds tick(std::max(_config.timer_tick_us,1u)*int64_t(1000));
+    std::vector<TimerJob> expired;
+    std::unique_lock<std::mutex> lock(_timers_mutex);
+    while (_state!=ThreadPoolState::STOPPED) {
+        _timers.advance(timer_tick(),[&expired](ID, TimerJob &timer_job) {  expired.push_back(timer_job);  });
+        if (!expired.empty()) {
+            // the jobs are submitted without holding the lock, the timers can be added and cancelled meanwhile
+            lock.unlock();
+            for (auto &timer_job: expired) {
+                add_job(timer_job.job,timer_job.counter,timer_job.priority);
+                if (timer_job.counter)
+                    signal(*timer_job.counter);
+            }
+            expired.clear();
+            lock.lock();
+            continue;
         }
+        uint64_t next = _timers.next_tick();
+        if (next==UINT64_MAX)
+            _timers_cv.wait(lock);
+        else
+            _timers_cv.wait_until(lock,_timers_epoch+next*tick);
     }
-    _cv.notify_one();
+}
+
+uint64_t BasicThreadPool::timer_tick() const {
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-_timers_epoch);
+    return elapsed.count()/(std::max(_config.timer_tick_us,1u)*int64_t(1000));
+}
+
+ID BasicThreadPool::allocate_job(const Job &job, JobCounter *counter, JobPriority priority, unsigned int node, const CancellationToken *token, bool locked) {
+    ID job_id;
+    allocate_jobs(&job,1,counter,priority,node,token,locked,&job_id);
     return job_id;
 }
 
-bool BasicThreadPool::get_next_job(Job &job) {
-    std::unique_lock<std::mutex> lock(_mutex);
-    return get_next_job_unsafe(job);
+void BasicThreadPool::allocate_jobs(const Job *jobs, size_t count, JobCounter *counter, JobPriority priority, unsigned int node, const CancellationToken *token, bool locked, ID *ids) {
+    _num_jobs += count;
+    if (counter)
+        counter->value += count;
+    size_t i = 0;
+    // workers allocate from their own ring, without synchronization
+    auto worker_idx = current_worker();
+    if (worker_idx!=UINT32_MAX) {
+        while (i<count && allocate_slot(worker_idx,jobs[i],counter,priority,node,token,locked,ids[i]))
+            i++;
+    }
+    // other threads (and workers with a full ring) share the remaining rings, locked once for the whole batch.
+    // The search starts from the last ring with free slots, so that the full rings are not scanned every time
+    while (i<count) {
+        size_t num_allocated = i;
+        {
+            std::unique_lock<std::mutex> lock(_rings_mutex);
+            uint32_t num_shared = _num_rings-_num_worker_rings;
+            for (uint32_t k=0; i<count && k<=num_shared; k++) {
+                uint32_t r = _num_worker_rings+(_shared_ring_hint+k)%std::max(num_shared,1u);
+                if (k==num_shared) {
+                    // all the shared rings are full: create a new one
+                    if (_num_rings==max_job_rings)
+                        break;
+                    r = _num_rings;
+                    _rings[r] = new JobRing();
+                    _num_rings++;
+                }
+                while (i<count && allocate_slot(r,jobs[i],counter,priority,node,token,locked,ids[i]))
+                    i++;
+                _shared_ring_hint = r-_num_worker_rings;
+            }
+        }
+        // too many live jobs: wait for some of them to complete
+        if (i==num_allocated)
+            std::this_thread::yield();
+    }
+}
+
+bool BasicThreadPool::allocate_slot(uint32_t ring_idx, const Job &job, JobCounter *counter, JobPriority priority, unsigned int node, const CancellationToken *token, bool locked, ID &job_id) {
+    JobRing &ring = *_rings[ring_idx].load();
+    uint32_t slot = ring.allocate();
+    if (slot==UINT32_MAX)
+        return false;
+    ring.job(slot) = job;
+    // the parent is notified by the job only if it could take a reference on it
+    if (valid(job.parent_id) && !acquire_parent(job.parent_id))
+        ring.job(slot).parent_id = ID();
+    // a locked job holds an extra reference, and is marked before its id is visible to the other threads
+    if (locked)
+        ring.job(slot).unfinished_jobs++;
+    ring._locked[slot] = locked;
+    ring._flows[slot] = false;
+    ring._counters[slot] = counter;
+    ring._priorities[slot] = priority;
+    ring._nodes[slot] = node==any_node ? UINT16_MAX : node%_node_queues.size();
+    ring._tokens[slot] = token;
+    job_id = ID(ring_idx*job_ring_size+slot,ring.generation(slot));
+    return true;
+}
+
+bool BasicThreadPool::acquire_parent(ID parent_id) {
+    Job *parent = get_job(parent_id);
+    if (!parent || !_rings[parent_id.index/job_ring_size].load()->_locked[parent_id.index%job_ring_size])
+        return false;
+    // a parent already scheduled has no unfinished jobs: it can't wait for a new child anymore
+    int32_t unfinished = parent->unfinished_jobs.load();
+    while (unfinished>0) {
+        if (parent->unfinished_jobs.compare_exchange_weak(unfinished,unfinished+1))
+            return true;
+    }
+    return false;
+}
+
+Job* BasicThreadPool::get_job(ID job_id) {
+    uint32_t r = job_id.index/job_ring_size;
+    if (!valid(job_id) || r>=_num_rings.load())
+        return nullptr;
+    JobRing &ring = *_rings[r].load();
+    uint32_t slot = job_id.index%job_ring_size;
+    return ring.generation(slot)==job_id.internal_id ? &ring.job(slot) : nullptr;
+}
+
+void BasicThreadPool::execute_job(ID job_id) {
+    // the job is executed in place, in its ring
+    Job &job = *get_job(job_id);
+    run_job(job_id,job);
+    complete_job(job_id);
 }
 
-bool BasicThreadPool::get_next_job_unsafe(Job &job) {
-    auto job_id = _open_jobs_queue.front();
-    _open_jobs_queue.pop_front();
-    if (_jobs.has(job_id)) {
-        job = _jobs.get(job_id);
-        _jobs.remove(job_id);
+void BasicThreadPool::run_job(ID job_id, Job &job) {
+    // the cancelled jobs are dropped here, when dequeued
+    auto token = _rings[job_id.index/job_ring_size].load()->_tokens[job_id.index%job_ring_size];
+    if (token && token->is_cancelled()) {
+        job.discard();
+        return;
+    }
+    if (!job.function)
+        return;
+    if (_config.trace_jobs) {
+        double start = trc_get_time();
+        if (_rings[job_id.index/job_ring_size].load()->_flows[job_id.index%job_ring_size])
+            create_explicit_time_event(start,"threadpool","job",TRC_TYPE_ASYNC,'f',flow_id(job_id),0);
+        job.function(&job);
+        create_explicit_time_event_arg_int(start,"threadpool","job",TRC_TYPE_DURATION,'X',0,trc_get_time()-start,"id",(int)job_id.index);
+    } else {
+        job.function(&job);
+    }
+    // with fibers, the job can complete on another worker
+    auto worker_idx = current_worker();
+    if (worker_idx!=UINT32_MAX)
+        add_stat(_worker_data[worker_idx]->jobs_run,1);
+}
+
+void BasicThreadPool::complete_job(ID job_id) {
+    JobRing &ring = *_rings[job_id.index/job_ring_size].load();
+    uint32_t slot = job_id.index%job_ring_size;
+    // the slot can be reused as soon as it is released
+    JobCounter *counter = ring._counters[slot];
+    ring.release(slot);
+    bool notify = counter && release_counter(*counter);
+    notify = --_num_jobs==0 || notify;
+    // the waiters increase _num_waiters before checking their condition: either they see the new values or
+    // they are notified
+    if (notify && _num_waiters.load()>0)
+        notify_waiters();
+}
+
+void BasicThreadPool::signal(JobCounter &counter) {
+    if (release_counter(counter) && _num_waiters.load()>0)
+        notify_waiters();
+}
+
+bool BasicThreadPool::release_counter(JobCounter &counter) {
+    int32_t remaining = --counter.value;
+    if (remaining==JobCounter::awaited_flag) {
+        // a suspended coroutine awaits the counter, that stays alive until the continuation resumes it
+        Job continuation(counter.continuation,counter.continuation_data);
+        counter.value = 0;
+        add_job(continuation);
         return true;
     }
+    if (remaining!=0)
+        return false;
+    // a fiber parked on the counter can be waiting while all the workers are parked: the workers register
+    // before checking for ready fibers, and the counter is released before checking for parked fibers
+    if (_num_waiting_fibers.load()>0)
+        wake_workers(1,(unsigned int)JobPriority::NORMAL);
+    return true;
+}
+
+void BasicThreadPool::notify_waiters() {
+    { std::unique_lock<std::mutex> lock(_done_mutex); }
+    _done_cv.notify_all();
+}
+
+void BasicThreadPool::enqueue(ID job_id) {
+    auto level = (unsigned int)_rings[job_id.index/job_ring_size].load()->_priorities[job_id.index%job_ring_size];
+    enqueue(&job_id,1,level);
+}
+
+void BasicThreadPool::enqueue(const ID *job_ids, size_t count, unsigned int level) {
+    auto worker_idx = current_worker();
+    WorkerData *worker = worker_idx!=UINT32_MAX ? _worker_data[worker_idx].get() : nullptr;
+    unsigned int local_node = current_node();
+    // the jobs submitted by a job are linked to it, before they can be executed
+    for (size_t k=0; _config.trace_jobs && worker && k<count; k++) {
+        _rings[job_ids[k].index/job_ring_size].load()->_flows[job_ids[k].index%job_ring_size] = true;
+        create_event("threadpool","job",TRC_TYPE_ASYNC,'s',flow_id(job_ids[k]),0);
+    }
+    size_t i = 0;
+    while (i<count) {
+        // the jobs for the node of the worker go to its own queue, if not full
+        unsigned int node = job_node(job_ids[i],local_node);
+        if (worker && node==worker->node && worker->queues[level].push(job_ids[i])) {
+            uint64_t depth = worker->queues[level].size();
+            if (depth>worker->queue_high_water.load(std::memory_order_relaxed))
+                worker->queue_high_water.store(depth,std::memory_order_relaxed);
+            i++;
+            continue;
+        }
+        // consecutive jobs for another node are queued with one lock
+        size_t first = i++;
+        while (i<count && (!worker || node!=worker->node) && job_node(job_ids[i],local_node)==node)
+            i++;
+        auto &node_queues = *_node_queues[node];
+        std::unique_lock<std::mutex> lock(node_queues.mutex);
+        node_queues.queues[level].insert(node_queues.queues[level].end(),job_ids+first,job_ids+i);
+        node_queues.num_jobs[level] += i-first;
+    }
+    _num_open_jobs[level] += count;
+    wake_workers(count,level);
+}
+
+unsigned int BasicThreadPool::job_node(ID job_id, unsigned int local_node) const {
+    uint16_t node = _rings[job_id.index/job_ring_size].load()->_nodes[job_id.index%job_ring_size];
+    return node==UINT16_MAX ? local_node : node;
+}
+
+unsigned int BasicThreadPool::current_node() const {
+    auto worker_idx = current_worker();
+    if (worker_idx!=UINT32_MAX)
+        return _worker_data[worker_idx]->node;
+    if (_node_queues.size()==1)
+        return 0;
+    unsigned int cpu = current_cpu();
+    return cpu<_cpu_nodes.size() ? _cpu_nodes[cpu] : 0;
+}
+
+void BasicThreadPool::wake_workers(size_t num_jobs, unsigned int level) {
+    // the parking workers register before checking for open jobs, and the jobs are counted before checking
+    // for parked workers: either the worker sees the jobs or it is woken up here
+    if (_num_parked.load()==0)
+        return;
+    bool high = level==(unsigned int)JobPriority::HIGH;
+    // the polling workers take the new jobs without being woken up
+    size_t num_polling = _num_spinning.load()+(high ? _num_spinning_high.load() : 0);
+    if (num_jobs<=num_polling)
+        return;
+    size_t num_wake = num_jobs-num_polling;
+    std::unique_lock<std::mutex> lock(_park_mutex);
+    // the reserved workers first for the HIGH jobs; the last parked worker has the warmest cache
+    for (auto parked: {&_parked_high,&_parked}) {
+        if (parked==&_parked_high && !high)
+            continue;
+        while (num_wake>0 && !parked->empty()) {
+            _worker_data[parked->back()]->semaphore.post();
+            parked->pop_back();
+            _num_parked--;
+            num_wake--;
+        }
+    }
+}
+
+void BasicThreadPool::wake_all_workers() {
+    std::unique_lock<std::mutex> lock(_park_mutex);
+    for (auto parked: {&_parked_high,&_parked}) {
+        for (auto w: *parked)
+            _worker_data[w]->semaphore.post();
+        parked->clear();
+    }
+    _num_parked = 0;
+}
+
+THREADPOOL_NOINLINE unsigned int BasicThreadPool::current_worker() const {
+    return tls_pool==this ? tls_worker_idx : UINT32_MAX;
+}
+
+WorkerStats BasicThreadPool::worker_stats(unsigned int worker_idx) const {
+    const WorkerData &worker = *_worker_data[worker_idx];
+    WorkerStats stats;
+    stats.jobs_run = worker.jobs_run.load(std::memory_order_relaxed);
+    stats.steals = worker.steals.load(std::memory_order_relaxed);
+    stats.idle_ns = worker.idle_ns.load(std::memory_order_relaxed);
+    stats.parked = worker.parked.load(std::memory_order_relaxed);
+    stats.queue_high_water = worker.queue_high_water.load(std::memory_order_relaxed);
+    return stats;
+}
+
+size_t BasicThreadPool::local_open_jobs() const {
+    auto worker_idx = current_worker();
+    if (worker_idx==UINT32_MAX)
+        return 0;
+    size_t n = 0;
+    for (auto &q: _worker_data[worker_idx]->queues)
+        n += q.size();
+    return n;
+}
+
+size_t BasicThreadPool::open_jobs() const {
+    int64_t n = 0;
+    for (auto &c: _num_open_jobs)
+        n += c.load();
+    return std::max<int64_t>(n,0);
+}
+
+bool BasicThreadPool::get_next_job(Job &job) {
+    // the job is handed over to the caller: it is not tracked anymore
+    ID job_id;
+    if (!acquire_job(current_worker(),job_id))
+        return false;
+    job = *get_job(job_id);
+    complete_job(job_id);
+    return true;
+}
+
+bool BasicThreadPool::acquire_job(unsigned int worker_idx, ID &job_id) {
+    WorkerData *worker = worker_idx!=UINT32_MAX ? _worker_data[worker_idx].get() : nullptr;
+    if (worker && worker->high_priority_only)
+        return acquire_job(worker_idx,(unsigned int)JobPriority::HIGH,job_id);
+    // aging: from time to time the lowest levels are served first
+    bool aging = worker && _config.aging_period>0 && (worker->num_acquired+1)%_config.aging_period==0;
+    for (unsigned int i=0; i<num_job_priorities; i++) {
+        unsigned int level = aging ? num_job_priorities-1-i : i;
+        if (acquire_job(worker_idx,level,job_id)) {
+            if (worker)
+                worker->num_acquired++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BasicThreadPool::acquire_job(unsigned int worker_idx, unsigned int level, ID &job_id) {
+    if (_num_open_jobs[level].load()<=0)
+        return false;
+    WorkerData *worker = worker_idx!=UINT32_MAX ? _worker_data[worker_idx].get() : nullptr;
+    unsigned int node = current_node();
+    unsigned int num_nodes = _node_queues.size();
+    // local queue first (LIFO)
+    bool found = worker && worker->queues[level].pop(job_id);
+    // then the jobs submitted from outside to the node
+    if (!found)
+        found = pop_node_job(node,level,job_id);
+    // then steal from the workers of the same node, starting from a random victim
+    if (!found && worker)
+        found = steal_job(*worker,level,0,worker->num_local_victims,job_id);
+    // finally the other nodes: their queues, then their workers
+    for (unsigned int i=1; i<num_nodes && !found; i++)
+        found = pop_node_job((node+i)%num_nodes,level,job_id);
+    if (!found && worker)
+        found = steal_job(*worker,level,worker->num_local_victims,worker->victims.size(),job_id);
+    for (uint32_t victim=0; !worker && !found && victim<_worker_data.size(); victim++)
+        found = _worker_data[victim]->queues[level].steal(job_id);
+    if (!found)
+        return false;
+    _num_open_jobs[level]--;
+    return true;
+}
+
+bool BasicThreadPool::pop_node_job(unsigned int node, unsigned int level, ID &job_id) {
+    auto &node_queues = *_node_queues[node];
+    if (node_queues.num_jobs[level].load()<=0)
+        return false;
+    std::unique_lock<std::mutex> lock(node_queues.mutex);
+    auto &queue = node_queues.queues[level];
+    if (queue.empty())
+        return false;
+    job_id = queue.front();
+    queue.pop_front();
+    node_queues.num_jobs[level]--;
+    return true;
+}
+
+bool BasicThreadPool::steal_job(WorkerData &worker, unsigned int level, unsigned int begin, unsigned int end, ID &job_id) {
+    if (begin>=end || _num_open_jobs[level].load()<=0)
+        return false;
+    uint32_t n = end-begin;
+    uint32_t r = next_random(worker.rng_state);
+    for (uint32_t i=0; i<n; i++) {
+        if (_worker_data[worker.victims[begin+(r+i)%n]]->queues[level].steal(job_id)) {
+            add_stat(worker.steals,1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BasicThreadPool::pop_local_job(unsigned int worker_idx, ID &job_id) {
+    auto &worker = *_worker_data[worker_idx];
+    for (unsigned int level=0; level<num_job_priorities; level++) {
+        if (worker.queues[level].pop(job_id)) {
+            _num_open_jobs[level]--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BasicThreadPool::has_open_jobs(unsigned int worker_idx) const {
+    if (has_ready_fiber())
+        return true;
+    if (_worker_data[worker_idx]->high_priority_only)
+        return _num_open_jobs[(unsigned int)JobPriority::HIGH].load()>0;
+    for (auto &n: _num_open_jobs)
+        if (n.load()>0)
+            return true;
     return false;
 }
 
+bool BasicThreadPool::next_job(unsigned int worker_idx, ID &job_id) {
+    auto &worker = *_worker_data[worker_idx];
+    bool idle = false;
+    std::chrono::steady_clock::time_point idle_start;
+    while (true) {
+        auto state = _state.load();
+        if (state==ThreadPoolState::STOPPED)
+            return false;
+        if (state==ThreadPoolState::ACTIVE && acquire_job(worker_idx,job_id))
+            break;
+        // the fiber scheduler resumes the parked fibers first
+        if (has_ready_fiber()) {
+            job_id = ID();
+            break;
+        }
+        // the idle time includes the polling
+        if (!idle) {
+            idle = true;
+            idle_start = std::chrono::steady_clock::now();
+        }
+        if (state==ThreadPoolState::ACTIVE && poll_job(worker_idx,job_id))
+            break;
+        // nothing to do: park until new jobs are submitted
+        if (!park(worker_idx)) {
+            worker.retiring = true;
+            return false;
+        }
+    }
+    if (idle)
+        add_stat(worker.idle_ns,std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-idle_start).count());
+    return true;
+}
+
+bool BasicThreadPool::poll_job(unsigned int worker_idx, ID &job_id) {
+    auto &worker = *_worker_data[worker_idx];
+    auto &num_spinning = worker.high_priority_only ? _num_spinning_high : _num_spinning;
+    // spinning only helps if the submitters run on other cpus
+    static const bool multi_core = std::thread::hardware_concurrency()>1;
+    auto spin_time = std::chrono::microseconds(multi_core ? _config.idle_spin_us : 0);
+    auto poll_time = spin_time+std::chrono::microseconds(_config.idle_yield_us);
+    if (poll_time.count()==0)
+        return false;
+    num_spinning++;
+    bool found = false;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i=1; !found && _state==ThreadPoolState::ACTIVE; i++) {
+        // the clock is read every few iterations
+        auto elapsed = std::chrono::steady_clock::now()-start;
+        if (elapsed>=poll_time)
+            break;
+        for (uint32_t k=0; k<16 && !has_open_jobs(worker_idx); k++) {
+            if (elapsed<spin_time)
+                cpu_pause();
+            else
+                std::this_thread::yield();
+        }
+        if (has_ready_fiber())
+            break;
+        found = has_open_jobs(worker_idx) && acquire_job(worker_idx,job_id);
+    }
+    num_spinning--;
+    // more jobs than polling workers: pass the wake-up on
+    if (found && has_open_jobs(worker_idx))
+        wake_workers(1,worker.high_priority_only ? (unsigned int)JobPriority::HIGH : (unsigned int)JobPriority::NORMAL);
+    return found;
+}
+
+bool BasicThreadPool::park(unsigned int worker_idx) {
+    auto &worker = *_worker_data[worker_idx];
+    auto &parked = worker.high_priority_only ? _parked_high : _parked;
+    {
+        std::unique_lock<std::mutex> lock(_park_mutex);
+        parked.push_back(worker_idx);
+        _num_parked++;
+    }
+    // check again after registering: the jobs submitted in the meantime may not have woken this worker
+    auto state = _state.load();
+    if (state==ThreadPoolState::STOPPED || (state==ThreadPoolState::ACTIVE && has_open_jobs(worker_idx))) {
+        std::unique_lock<std::mutex> lock(_park_mutex);
+        auto it = std::find(parked.begin(),parked.end(),worker_idx);
+        if (it!=parked.end()) {
+            parked.erase(it);
+            _num_parked--;
+            return true;
+        }
+        // already removed by a submitter: consume its wake-up below
+    }
+    add_stat(worker.parked,1);
+    // the workers added by an elastic pool exit when idle for too long
+    if (worker_idx<_config.num_workers || state==ThreadPoolState::STOPPED) {
+        worker.semaphore.wait();
+        return true;
+    }
+    if (worker.semaphore.wait_for(std::chrono::milliseconds(_config.idle_timeout_ms)))
+        return true;
+    {
+        std::unique_lock<std::mutex> lock(_park_mutex);
+        auto it = std::find(parked.begin(),parked.end(),worker_idx);
+        if (it!=parked.end()) {
+            parked.erase(it);
+            _num_parked--;
+            return false;
+        }
+    }
+    // woken up while timing out
+    worker.semaphore.wait();
+    return true;
+}
+
 // start the workers
 void BasicThreadPool::start() {
-    std::unique_lock<std::mutex> lock(_mutex);
     _state = ThreadPoolState::ACTIVE;
-    _cv.notify_all();
+    wake_all_workers();
 }
 
-// wait until all workers complete
+// wait until all jobs complete
 void BasicThreadPool::wait() {
-    /// \todo replace the wait spin with a condition variable
-    while (_state!=ThreadPoolState::STOPPED && _jobs.size()>0)
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1));
+    std::unique_lock<std::mutex> lock(_done_mutex);
+    _num_waiters++;
+    _done_cv.wait(lock, [&]{ return _state==ThreadPoolState::STOPPED || _num_jobs.load()==0; });
+    _num_waiters--;
+}
+
+void BasicThreadPool::wait_for(JobCounter &counter) {
+    if (Fiber *fiber = current_fiber()) {
+        // park the job: the scheduler of the worker parks the fiber after switching back to its own stack
+        if (!counter.done()) {
+            fiber->wait_counter = &counter;
+            fiber->context.switch_to(*fiber->scheduler);
+        }
+        return;
+    }
+    auto worker_idx = current_worker();
+    if (worker_idx!=UINT32_MAX) {
+        // workers can't sleep: the jobs they are waiting for could be in their own queue.
+        // The own jobs are executed first: they are likely the children of the waiting job
+        ID job_id;
+        while (!counter.done() && _state!=ThreadPoolState::STOPPED) {
+            // with fibers, this is a job running on the worker stack: the counter could depend on parked jobs
+            if (Fiber *fiber = ready_fiber())
+                run_fiber(*_worker_data[worker_idx],fiber);
+            else if (pop_local_job(worker_idx,job_id) || acquire_job(worker_idx,job_id))
+                execute_job(job_id);
+            else
+                std::this_thread::yield();
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(_done_mutex);
+    _num_waiters++;
+    _done_cv.wait(lock, [&]{ return _state==ThreadPoolState::STOPPED || counter.done(); });
+    _num_waiters--;
 }
 
 // stop the execution
 void BasicThreadPool::stop() {
-    std::unique_lock<std::mutex> lock(_mutex);
     _state = ThreadPoolState::STOPPED;
+    wake_all_workers();
+    notify_waiters();
+    { std::unique_lock<std::mutex> lock(_manager_mutex); }
+    _manager_cv.notify_all();
+    { std::unique_lock<std::mutex> lock(_timers_mutex); }
+    _timers_cv.notify_all();
 }
 
 // clear the queue of open jobs;
 void BasicThreadPool::clear() {
-
+    // the jobs are executed as cancelled: the jobs that become ready meanwhile (e.g. their parents) are dropped too
+    ID job_id;
+    while (acquire_job(UINT32_MAX,job_id)) {
+        _rings[job_id.index/job_ring_size].load()->_tokens[job_id.index%job_ring_size] = &_cleared;
+        execute_job(job_id);
+    }
 }
 
 
-void BasicThreadPool::worker_thread_function() {
-    while (_state!=ThreadPoolState::STOPPED) {
-        Job job;
-        {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _cv.wait(lock, [&]{ return _state==ThreadPoolState::STOPPED
-                    || (_state==ThreadPoolState::ACTIVE && !_open_jobs_queue.empty()); });
-            // if stopped, exit
-            if (_state==ThreadPoolState::STOPPED) {
-                // printf("stop!!! (thread %llu)\n",thread_id());
-                return;
-            }
-            // here we are guaranteed that there is at least a job in the queue
-            if (!get_next_job_unsafe(job)) {
-                // printf("no more open jobs!!! (thread %llu)\n",thread_id());
-                return;
+void BasicThreadPool::worker_thread_function(unsigned int worker_idx) {
+    tls_pool = this;
+    tls_worker_idx = worker_idx;
+    // a worker that can't be pinned (e.g. cpu not available to the process) runs unpinned, in its node anyway
+    if (_worker_data[worker_idx]->cpu!=UINT32_MAX)
+        pin_current_thread(_worker_data[worker_idx]->cpu);
+    ID job_id;
+    if (!_fibers.empty()) {
+        fiber_scheduler(worker_idx);
+    } else {
+        while (next_job(worker_idx,job_id)) {
+            // printf("execute fun in thread %llu\n",thread_id());
+            execute_job(job_id);
+        }
+    }
+    // an idle worker of an elastic pool leaves its slot to the next added worker
+    WorkerData &worker = *_worker_data[worker_idx];
+    if (worker.retiring) {
+        if (worker.free_fiber) {
+            std::unique_lock<std::mutex> lock(_fibers_mutex);
+            _free_fibers.push_back(worker.free_fiber);
+            worker.free_fiber = nullptr;
+        }
+        _num_active--;
+        worker.live = false;
+    }
+}
+
+void BasicThreadPool::fiber_scheduler(unsigned int worker_idx) {
+    WorkerData &worker = *_worker_data[worker_idx];
+    ID job_id;
+    while (true) {
+        // the parked jobs are resumed first: they were started earlier
+        Fiber *fiber = ready_fiber();
+        if (!fiber) {
+            if (!next_job(worker_idx,job_id))
+                break;
+            if (!valid(job_id))
+                continue;
+            fiber = acquire_fiber(worker);
+            if (!fiber) {
+                // all the fibers are in use: run the job on the worker stack
+                execute_job(job_id);
+                continue;
             }
+            fiber->job_id = job_id;
         }
-        // printf("execute fun in thread %llu\n",thread_id());
-        if (job.function)
-            job.function(&job);
+        run_fiber(worker,fiber);
     }
 }
 
+void BasicThreadPool::run_fiber(WorkerData &worker, Fiber *fiber) {
+    FiberContext scheduler;
+    fiber->scheduler = &scheduler;
+    tls_fiber = fiber;
+    scheduler.switch_to(fiber->context);
+    tls_fiber = nullptr;
+    if (fiber->wait_counter) {
+        // the job is waiting: the fiber can be resumed as soon as it is in the list
+        std::unique_lock<std::mutex> lock(_fibers_mutex);
+        _waiting_fibers.push_back(fiber);
+        _num_waiting_fibers++;
+    } else if (worker.free_fiber) {
+        std::unique_lock<std::mutex> lock(_fibers_mutex);
+        _free_fibers.push_back(fiber);
+    } else {
+        worker.free_fiber = fiber;
+    }
+}
 
+void BasicThreadPool::fiber_function(void *fiber_ptr) {
+    Fiber *fiber = static_cast<Fiber*>(fiber_ptr);
+    while (true) {
+        fiber->pool->execute_job(fiber->job_id);
+        // the job may have been resumed on another worker: return to the scheduler that resumed it
+        fiber->context.switch_to(*fiber->scheduler);
+    }
+}
 
+THREADPOOL_NOINLINE BasicThreadPool::Fiber* BasicThreadPool::current_fiber() const {
+    return tls_pool==this ? static_cast<Fiber*>(tls_fiber) : nullptr;
+}
 
+BasicThreadPool::Fiber* BasicThreadPool::ready_fiber() {
+    if (_num_waiting_fibers.load()==0)
+        return nullptr;
+    std::unique_lock<std::mutex> lock(_fibers_mutex);
+    for (size_t i=0; i<_waiting_fibers.size(); i++) {
+        Fiber *fiber = _waiting_fibers[i];
+        if (fiber->wait_counter->done()) {
+            _waiting_fibers[i] = _waiting_fibers.back();
+            _waiting_fibers.pop_back();
+            _num_waiting_fibers--;
+            fiber->wait_counter = nullptr;
+            return fiber;
+        }
+    }
+    return nullptr;
+}
 
-ThreadPool::ThreadPool(unsigned int num_worker_threads)
-: BasicThreadPool(0) {
-    // create the worker threads
-    for (auto i=0; i<num_worker_threads; i++) {
-        _workers.push_back(std::thread(&ThreadPool::worker_thread_function,this));
+bool BasicThreadPool::has_ready_fiber() const {
+    if (_num_waiting_fibers.load()==0)
+        return false;
+    std::unique_lock<std::mutex> lock(_fibers_mutex);
+    for (auto fiber: _waiting_fibers)
+        if (fiber->wait_counter->done())
+            return true;
+    return false;
+}
+
+BasicThreadPool::Fiber* BasicThreadPool::acquire_fiber(WorkerData &worker) {
+    Fiber *fiber = worker.free_fiber;
+    if (fiber) {
+        worker.free_fiber = nullptr;
+        return fiber;
     }
+    std::unique_lock<std::mutex> lock(_fibers_mutex);
+    if (_free_fibers.empty())
+        return nullptr;
+    fiber = _free_fibers.back();
+    _free_fibers.pop_back();
+    return fiber;
+}
+
+
+
+BlockingRegion::BlockingRegion(BasicThreadPool &pool)
+: _pool(pool.current_worker()!=UINT32_MAX ? &pool : nullptr) {
+    if (_pool)
+        _pool->enter_blocking_region();
+}
+
+BlockingRegion::~BlockingRegion() {
+    if (_pool)
+        _pool->leave_blocking_region();
+}
+
+
+
+
+
+ThreadPool::ThreadPool(unsigned int num_worker_threads)
+: ThreadPool(ThreadPoolConfig(num_worker_threads)) {
+}
+
+ThreadPool::ThreadPool(const ThreadPoolConfig &config)
+: BasicThreadPool(config,false) {
+    // create the worker threads, now that execute_job() is the one of ThreadPool
+    create_workers();
 }
 
 ThreadPool::~ThreadPool() {
+    // the workers must terminate while the derived execute_job() is still available
+    join_workers();
+}
+
+ID ThreadPool::add_locked_job(const Job &job, JobCounter *counter, JobPriority priority, const CancellationToken *token) {
+    return allocate_job(job,counter,priority,any_node,token,true);
 }
 
-ID ThreadPool::add_locked_job(const Job &job) {
-    std::unique_lock<std::mutex> lock(_mutex);
-    auto id = _jobs.add(job);
-    _jobs.get(id).unfinished_jobs++;
-    _locked_jobs.insert(id);
-    return id;
+void ThreadPool::add_locked_jobs(const Job *jobs, size_t count, ID *ids, JobCounter *counter, JobPriority priority, const CancellationToken *token) {
+    allocate_jobs(jobs,count,counter,priority,any_node,token,true,ids);
 }
 
 void ThreadPool::unlock_job(ID job_id) {
-    std::unique_lock<std::mutex> lock(_mutex);
-    if (_jobs.has(job_id))
-        _jobs.get(job_id).unfinished_jobs--;
+    // the thread that brings the counter to zero schedules the job
+    Job *job = get_job(job_id);
+    if (job && --job->unfinished_jobs==0)
+        enqueue(job_id);
 }
 
-void ThreadPool::wait() {
-    /// \todo replace the wait spin with a condition variable
-    while (_state!=ThreadPoolState::STOPPED && _jobs.size()>0) {
-        std::this_thread::sleep_for(std::chrono::nanoseconds(1));
+void ThreadPool::unlock_jobs(const ID *job_ids, size_t count) {
+    // the unlocked jobs are scheduled in one batch per priority level
+    std::vector<ID> ready[num_job_priorities];
+    for (size_t i=0; i<count; i++) {
+        ID job_id = job_ids[i];
+        Job *job = get_job(job_id);
+        if (job && --job->unfinished_jobs==0)
+            ready[(unsigned int)_rings[job_id.index/job_ring_size].load()->_priorities[job_id.index%job_ring_size]].push_back(job_id);
     }
+    for (unsigned int level=0; level<num_job_priorities; level++)
+        if (!ready[level].empty())
+            enqueue(ready[level].data(),ready[level].size(),level);
 }
 
-void ThreadPool::worker_thread_function() {
-    while (_state!=ThreadPoolState::STOPPED) {
-        Job job;
-        {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _cv.wait(lock, [&]{ return _state==ThreadPoolState::STOPPED
-                    || (_state==ThreadPoolState::ACTIVE && !_open_jobs_queue.empty()); });
-            // if stopped, exit
-            if (_state==ThreadPoolState::STOPPED) {
-                // printf("stop!!! (thread %llu)\n",thread_id());
-                return;
-            }
-            // here we are guaranteed that there is at least a job in the queue
-            if (!get_next_job_unsafe(job)) {
-                // printf("no more open jobs!!! (thread %llu)\n",thread_id());
-                return;
-            }
-        }
-        // printf("execute fun in thread %llu\n",thread_id());
-        if (job.function)
-            job.function(&job);
-        // notify the parent job
-        if (valid(job.parent_id)) {
-            std::unique_lock<std::mutex> lock(_mutex);
-            if (_jobs.has(job.parent_id)) {
-                Job &j = _jobs.get(job.parent_id);
-                j.unfinished_jobs--;
-                if (j.unfinished_jobs<=0) {
-                    _locked_jobs.erase(job.parent_id);
-                    _open_jobs_queue.push_back(job.parent_id);
-                }
-            }
-        }
+void ThreadPool::execute_job(ID job_id) {
+    // the job is executed in place, in its ring
+    Job &job = *get_job(job_id);
+    run_job(job_id,job);
+    // notify the parent job; the parent is executed preferably by this worker
+    if (valid(job.parent_id)) {
+        Job *parent = get_job(job.parent_id);
+        if (parent && --parent->unfinished_jobs==0)
+            enqueue(job.parent_id);
     }
+    complete_job(job_id);
 }
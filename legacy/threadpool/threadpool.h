@@ -1,19 +1,36 @@
 #pragma once
 
 #include "common/foundation_types.h"
-#include "common/idtable.h"
+#include "work_stealing_queue.h"
+#include "fiber.h"
+#include "slab_allocator.h"
+#include "semaphore.h"
+#include "cpu_topology.h"
+#include "timer_wheel.h"
 
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
 #include <atomic>
+#include <chrono>
 // #include <list>
-#include <set>
 #include <deque>
 #include <vector>
+#include <memory>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
 
+// coroutine support (see task.h)
+#if __cplusplus >= 202002L
+#define THREADPOOL_HAS_COROUTINES 1
+#include <coroutine>
+#else
+#define THREADPOOL_HAS_COROUTINES 0
+#endif
+
 struct Job;
 
 typedef void (*JobFunction)(Job*);
@@ -23,15 +40,19 @@ typedef void (*JobFunction)(Job*);
 /// \brief structure containing the job data (function and IO data)
 /// \details this struct is defined to be exactly the same length of a cache line, to avoid
 /// false-sharing problems. On creation it is zero initialized, except for the parent_id that is set to the invalid ID.
+/// The number of unfinished jobs is atomic, since the children notify their completion from any worker.\n
+/// The local data is 16 bytes aligned and is copied with the job, so it can only hold trivially copyable data.
+/// A job can also wrap any callable taking no arguments: trivially copyable callables fitting in the local data
+/// are stored inline, the others are moved to a block of the SlabAllocator, destroyed and released after the call
+/// (or by discard(), if the job is dropped).
 /// \todo find a more elegant set of constuctors
 struct Job {
     JobFunction function;
     // Job* parent;
     ID parent_id;
-    // std::atomic<int32_t> unfinished_jobs; // atomic
-    int32_t unfinished_jobs;
-    static const unsigned local_data_len = CACHE_LINE_SIZE-sizeof(function)-sizeof(parent_id)-sizeof(unfinished_jobs);
-    char local_data[local_data_len];
+    static const unsigned local_data_len = CACHE_LINE_SIZE-sizeof(function)-sizeof(parent_id)-sizeof(std::atomic<int32_t>);
+    alignas(16) char local_data[local_data_len];
+    std::atomic<int32_t> unfinished_jobs;
 
     // constructors
     Job()
@@ -45,9 +66,188 @@ struct Job {
     template <typename T>
     Job(const JobFunction &func, const T &func_data, ID parent_job=ID(), int32_t num_unfinished_jobs=0)
     : function(func), parent_id(parent_job), unfinished_jobs(num_unfinished_jobs){
+        static_assert(sizeof(T)<=local_data_len, "the job data does not fit in Job::local_data");
+        static_assert(std::is_trivially_copyable<T>::value, "the job data must be trivially copyable");
         memset(local_data,0,sizeof(local_data));
         memcpy(local_data,&func_data,sizeof(T));
     }
+    /// wrap a callable taking no arguments
+    template <typename F, typename = decltype(std::declval<typename std::decay<F>::type&>()())>
+    explicit Job(F &&callable, ID parent_job=ID())
+    : parent_id(parent_job), unfinished_jobs(0) {
+        typedef typename std::decay<F>::type Callable;
+        memset(local_data,0,sizeof(local_data));
+        store_callable<Callable>(std::forward<F>(callable),std::integral_constant<bool,is_inline<Callable>()>());
+    }
+    Job(const Job &other)
+    : function(other.function), parent_id(other.parent_id), unfinished_jobs(other.unfinished_jobs.load()) {
+        memcpy(local_data,other.local_data,sizeof(local_data));
+    }
+    Job& operator=(const Job &other) {
+        function = other.function;
+        parent_id = other.parent_id;
+        unfinished_jobs = other.unfinished_jobs.load();
+        memcpy(local_data,other.local_data,sizeof(local_data));
+        return *this;
+    }
+
+    /// true if the job wraps a callable stored out of line, released by the first call: such a job can be
+    /// executed only once
+    bool owns_callable() const {
+        const char *tag;
+        memcpy(&tag,local_data+sizeof(void*),sizeof(tag));
+        return tag==stored_tag();
+    }
+    /// release the resources of a job that is not executed: a callable stored out of line is destroyed without
+    /// being called
+    void discard() {
+        if (!owns_callable())
+            return;
+        discarding() = true;
+        function(this);
+        discarding() = false;
+    }
+
+private:
+    /// true if the callable can be stored in the local data
+    template <typename Callable>
+    static constexpr bool is_inline() {
+        return sizeof(Callable)<=local_data_len && alignof(Callable)<=16 && std::is_trivially_copyable<Callable>::value;
+    }
+    template <typename Callable, typename F>
+    void store_callable(F &&callable, std::true_type) {
+        new(local_data) Callable(std::forward<F>(callable));
+        function = &call_inline<Callable>;
+    }
+    template <typename Callable, typename F>
+    void store_callable(F &&callable, std::false_type) {
+        static_assert(alignof(Callable)<=alignof(std::max_align_t), "over-aligned callables are not supported");
+        Callable *ptr = new(SlabAllocator::allocate(sizeof(Callable))) Callable(std::forward<F>(callable));
+        const char *tag = stored_tag();
+        memcpy(local_data,&ptr,sizeof(ptr));
+        memcpy(local_data+sizeof(ptr),&tag,sizeof(tag));
+        function = &call_stored<Callable>;
+    }
+    template <typename Callable>
+    static void call_inline(Job *job) {
+        (*reinterpret_cast<Callable*>(job->local_data))();
+    }
+    template <typename Callable>
+    static void call_stored(Job *job) {
+        Callable *ptr;
+        memcpy(&ptr,job->local_data,sizeof(ptr));
+        if (!discarding())
+            (*ptr)();
+        ptr->~Callable();
+        SlabAllocator::deallocate(ptr,sizeof(Callable));
+    }
+    /// marker stored after the pointer of the callables stored out of line
+    static const char* stored_tag() {
+        static const char tag = 0;
+        return &tag;
+    }
+    /// true while discard() releases a callable
+    static bool& discarding() {
+        static thread_local bool d = false;
+        return d;
+    }
+};
+
+static_assert(sizeof(Job)==CACHE_LINE_SIZE, "a job must fill exactly one cache line");
+
+/// \enum JobPriority
+/// \brief latency class of a job. Workers always execute the open jobs of the higher levels first.
+enum class JobPriority : uint8_t {
+    HIGH = 0,   ///< latency critical jobs
+    NORMAL,     ///< default level
+    BACKGROUND  ///< throughput jobs, executed when there is no other work (or when aged)
+};
+/// number of priority levels
+static const unsigned int num_job_priorities = 3;
+/// node hint of the jobs without affinity: they are queued on the node of the submitting thread
+static const unsigned int any_node = UINT32_MAX;
+
+/// \struct JobCounter
+/// \brief atomic counter of unfinished jobs
+/// \details the counter is increased when a job referencing it is submitted and decreased when the job completes.
+/// wait_for() returns when the counter reaches zero. The counter is owned by the caller and must outlive its jobs.\n
+/// A counter can also be awaited by one coroutine at a time: the awaiting coroutine sets awaited_flag in the value
+/// and a continuation job, submitted by the worker that completes the last job.
+struct JobCounter {
+    std::atomic<int32_t> value;
+    JobFunction          continuation = nullptr;      ///< job submitted when the counter of an awaited counter reaches zero
+    void                *continuation_data = nullptr; ///< local data of the continuation job
+
+    static const int32_t awaited_flag = 1<<30; ///< set in the value while a coroutine awaits the counter
+
+    JobCounter(int32_t initial_value=0)
+    : value(initial_value) {}
+    JobCounter(const JobCounter&) = delete;
+
+    /// true if all the jobs referencing the counter are complete
+    bool done() const {  return value.load()==0;  }
+};
+
+/// \struct CancellationToken
+/// \brief cooperative cancellation of a group of jobs
+/// \details the jobs submitted with a token are dropped without being executed if the token is cancelled when they
+/// are dequeued: they complete as usual (counters, parent jobs) but their function is not called. Running jobs can
+/// poll is_cancelled(), a couple of relaxed loads. A token created with a parent is cancelled together with its
+/// parent, so cancelling a request cancels all its sub-tasks. The token is owned by the caller and must outlive
+/// its jobs.
+struct CancellationToken {
+    explicit CancellationToken(const CancellationToken *parent_token=nullptr)
+    : cancelled(false), parent(parent_token) {}
+    CancellationToken(const CancellationToken&) = delete;
+
+    /// cancel the token and its children
+    void cancel() {  cancelled.store(true,std::memory_order_relaxed);  }
+    /// true if the token or one of its ancestors has been cancelled
+    bool is_cancelled() const {
+        for (auto t=this; t; t=t->parent)
+            if (t->cancelled.load(std::memory_order_relaxed))
+                return true;
+        return false;
+    }
+
+    std::atomic<bool>        cancelled;
+    const CancellationToken *parent;
+};
+
+/// number of jobs of a JobRing
+static const uint32_t job_ring_size = 4096;
+/// maximum number of JobRings of a pool
+static const uint32_t max_job_rings = 256;
+
+/// \struct JobRing
+/// \brief ring allocator of cache line aligned jobs
+/// \details the slots are allocated in order by a single owner thread and released by the thread that completes
+/// the job. Each slot has a generation counter, odd while the job is alive and even when the slot is free:
+/// job handles store the slot index and the generation at the allocation, so that stale handles are detected.
+struct JobRing {
+    JobRing();
+    JobRing(const JobRing&) = delete;
+    ~JobRing();
+
+    /// allocate a slot. Can be called only by the owner thread.
+    /// \return the slot index, UINT32_MAX if all the slots are in use
+    uint32_t allocate();
+    /// release a slot. Can be called by any thread.
+    void release(uint32_t slot) {  _generations[slot].fetch_add(1,std::memory_order_release);  }
+    /// current generation of a slot
+    uint32_t generation(uint32_t slot) const {  return _generations[slot].load(std::memory_order_acquire);  }
+    Job& job(uint32_t slot) {  return _jobs[slot];  }
+
+    char                  *_block;                      ///< allocated memory
+    Job                   *_jobs;                       ///< cache line aligned jobs
+    std::atomic<uint32_t>  _generations[job_ring_size];
+    JobCounter            *_counters[job_ring_size];    ///< counters decremented when the jobs complete
+    JobPriority            _priorities[job_ring_size];  ///< priority levels of the jobs
+    uint16_t               _nodes[job_ring_size];       ///< node hints of the jobs, UINT16_MAX for any node
+    const CancellationToken *_tokens[job_ring_size];    ///< cancellation tokens of the jobs, nullptr if none
+    bool                   _locked[job_ring_size];      ///< the jobs have been created locked, and can have children
+    bool                   _flows[job_ring_size];       ///< a trace flow event links the jobs to the jobs that submitted them
+    uint32_t               _cursor;                     ///< next slot to check for allocation
 };
 
     // template <>
@@ -57,6 +257,44 @@ struct Job {
     //     // memcpy(local_data,func_data,sizeof(T));
     // }
 
+/// \struct ThreadPoolConfig
+/// \brief configuration of a thread pool
+/// \details with use_fibers the jobs run on the fiber stacks, of fiber_stack_size bytes each: jobs recursing deeply or
+/// with large local variables need a larger size. A guard page below every stack makes an overflow crash instead
+/// of corrupting the memory.
+struct ThreadPoolConfig {
+    unsigned int num_workers               = 0;  ///< number of worker threads
+    unsigned int num_high_priority_workers = 0;  ///< workers reserved to the HIGH level (at most num_workers-1)
+    unsigned int aging_period              = 32; ///< every aging_period jobs a worker serves the lowest non empty level first (0 disables aging)
+    unsigned int idle_spin_us              = 20;    ///< an idle worker polls for new jobs spinning for this time (not on single cpu machines)...
+    unsigned int idle_yield_us             = 100;   ///< ...then yielding for this time, before parking
+    bool         use_fibers                = false;     ///< run the jobs in fibers: wait_for() parks the job instead of blocking its worker
+    unsigned int num_fibers                = 128;       ///< number of preallocated fibers, shared by all the workers
+    size_t       fiber_stack_size          = 64*1024;   ///< stack size of a fiber in bytes, rounded up to whole pages
+    bool         pin_workers               = false;     ///< pin the workers to the cpus, one per physical core first (Linux only)
+    const CpuTopology *topology            = nullptr;   ///< topology used to place the pinned workers, detected if null
+    unsigned int max_workers               = 0;     ///< elastic pool if greater than num_workers: workers are added on demand up to max_workers
+    unsigned int grow_threshold            = 2;     ///< a worker is added when there are more queued jobs than grow_threshold per running worker...
+    unsigned int grow_delay_us             = 1000;  ///< ...for this time
+    unsigned int idle_timeout_ms           = 1000;  ///< an added worker parked for this time exits
+    unsigned int manager_period_us         = 500;   ///< period of the load checks of the elastic pools
+    unsigned int timer_tick_us             = 1000;  ///< resolution of the delayed and periodic jobs
+    bool         trace_jobs                = false; ///< record every job as a tracing event (see tracing/tracing.h, trc_init() must be called first)
+
+    ThreadPoolConfig(unsigned int num_worker_threads=0)
+    : num_workers(num_worker_threads) {}
+};
+
+/// \struct WorkerStats
+/// \brief scheduler counters of a worker, since the creation of the pool
+struct WorkerStats {
+    uint64_t jobs_run         = 0;  ///< jobs executed (the dropped ones are not counted)
+    uint64_t steals           = 0;  ///< jobs stolen from the other workers
+    uint64_t idle_ns          = 0;  ///< time spent polling and parked, in nanoseconds
+    uint64_t parked           = 0;  ///< number of times the worker has been parked
+    uint64_t queue_high_water = 0;  ///< maximum number of jobs in a queue of the worker
+};
+
 /// \enum ThreadPoolState
 enum class ThreadPoolState {
     PAUSED = 0, ///< thread pool is not executing jobs
@@ -65,77 +303,392 @@ enum class ThreadPoolState {
 };
 
 
+class BlockingRegion;
+
 /// \class BasicThreadPool
 /// \brief simple thred pool, with no job dependencies
-/// \details the jobs are scheduled in the order they are submitted to the queue, without checking for dependencies.
+/// \details each worker owns a lock-free work-stealing queue: jobs submitted by a worker are pushed in its own
+/// queue and executed in LIFO order, while idle workers steal the oldest jobs of random victims.
+/// Jobs submitted from other threads go to a shared queue. Dependencies between jobs are not checked.\n
+/// The jobs are stored in ring allocators: each worker allocates from its own JobRing, the other threads
+/// share a set of rings created on demand. Job ids are handles (ring slot and generation) resolved without locks.\n
+/// Every priority level has its own queues. Workers drain the higher levels first; to avoid starvation, every
+/// aging_period jobs a worker serves the lowest non empty level first. Reserved workers only execute HIGH jobs.\n
+/// Idle workers poll for new jobs, spinning for idle_spin_us and yielding for idle_yield_us, then park on their own
+/// semaphore. Submitters wake up parked workers only for the jobs that the polling workers can't take.\n
+/// With use_fibers, the workers execute the jobs in a pool of preallocated fibers: a job calling wait_for() is
+/// parked and its worker continues with other jobs; the first worker that finds the counter at zero resumes the
+/// job, possibly on another thread. When all the fibers are in use the jobs run on the worker stacks.\n
+/// With pin_workers, each worker is pinned to a cpu of the topology and belongs to its NUMA node. Every node has
+/// its own shared queues: the jobs submitted from outside go to the queues of the submitter node, or of the node
+/// given as hint. Workers look for jobs in their own queue, then in the queues of their node, then steal from the
+/// workers of the same node, and only then move to the other nodes.\n
+/// With max_workers greater than num_workers the pool is elastic: a manager thread adds workers when the queued jobs
+/// exceed grow_threshold per running worker for grow_delay_us, or when workers blocked in a blocking_region() leave
+/// less than num_workers workers running while jobs are queued. The added workers exit after idle_timeout_ms parked.\n
+/// Delayed and periodic jobs are kept in a hierarchical TimerWheel with a resolution of timer_tick_us, serviced by
+/// a timer thread started with the first timer: the thread sleeps until the next expiration and submits the jobs
+/// that are due.\n
+/// Every worker updates its own WorkerStats counters, that can be read at any time without locking. With
+/// trace_jobs each executed job is recorded as a duration event, linked by a flow event to the job that submitted
+/// it, so that chrome://tracing shows the actual schedule.
 class BasicThreadPool {
 public:
     BasicThreadPool(unsigned int num_worker_threads);
+    BasicThreadPool(const ThreadPoolConfig &config);
     BasicThreadPool(const BasicThreadPool&) = delete;
     virtual ~BasicThreadPool();
 
-    /// add a job to the pool
+    /// add a job to the pool. If given, the counter is increased now and decreased when the job completes.
+    /// If given, the job is dropped when dequeued after the token has been cancelled.
     /// \return the id of the job in the pool
-    ID add_job(const Job &job);
-
-    size_t open_jobs()  {  return _open_jobs_queue.size();  };
-
-    /// get the next open job.
+    ID add_job(const Job &job, JobCounter *counter=nullptr, JobPriority priority=JobPriority::NORMAL, const CancellationToken *token=nullptr);
+    ID add_job(const Job &job, JobPriority priority) {  return add_job(job,nullptr,priority);  }
+    /// add a batch of jobs sharing the counter and the priority. The batch is allocated and queued with one lock
+    /// (none from a worker), and wakes up at most as many sleeping workers as there are jobs.
+    /// If not null, ids receives the ids of the jobs.
+    void add_jobs(const Job *jobs, size_t count, JobCounter *counter=nullptr, JobPriority priority=JobPriority::NORMAL, ID *ids=nullptr, const CancellationToken *token=nullptr);
+    /// add a job to be executed preferably by the workers of a NUMA node, e.g. the node owning its data.
+    /// The hint is ignored by the pools without pinned workers, that have a single node.
+    ID add_job_on_node(const Job &job, unsigned int node, JobCounter *counter=nullptr, JobPriority priority=JobPriority::NORMAL, const CancellationToken *token=nullptr);
+
+    /// add a job to the pool after a delay, rounded up to the timer resolution. If given, the counter is increased
+    /// now and decreased when the job completes, or when the timer is cancelled; wait() doesn't wait for the timers.
+    /// \return the id of the timer
+    ID add_job_after(std::chrono::nanoseconds delay, const Job &job, JobCounter *counter=nullptr, JobPriority priority=JobPriority::NORMAL);
+    /// add a copy of the job to the pool every period, the first time after one period, until the timer is
+    /// cancelled. Jobs that own a callable stored out of line can't be repeated and are dropped.
+    /// \return the id of the timer, an invalid id if the job is rejected
+    ID add_periodic_job(std::chrono::nanoseconds period, const Job &job, JobPriority priority=JobPriority::NORMAL);
+    /// cancel a delayed or periodic job that has not been submitted yet
+    /// \return false if the timer does not exist anymore (e.g. the delayed job has already been submitted)
+    bool cancel_timer(ID timer_id);
+    /// number of delayed and periodic jobs waiting for their timers
+    size_t pending_timers() const;
+
+    /// number of jobs ready to be executed
+    size_t open_jobs() const;
+    /// number of jobs of the given level ready to be executed
+    size_t open_jobs(JobPriority priority) const {  return std::max<int64_t>(_num_open_jobs[(unsigned)priority].load(),0);  }
+    /// number of jobs ready to be executed in the queue of the calling worker (0 if not a worker)
+    size_t local_open_jobs() const;
+    /// number of running worker threads
+    unsigned int num_workers() const {  return _num_active.load();  }
+    /// maximum number of worker threads; the worker indices are smaller
+    unsigned int max_workers() const {  return _worker_data.size();  }
+    /// index of the calling thread in this pool, UINT32_MAX if the thread is not a worker of this pool
+    unsigned int current_worker() const;
+    /// number of NUMA nodes with their own queues
+    unsigned int num_nodes() const {  return _node_queues.size();  }
+    /// NUMA node of a worker
+    unsigned int worker_node(unsigned int worker_idx) const {  return _worker_data[worker_idx]->node;  }
+    /// scheduler counters of a worker. The counters are read one by one while the worker updates them, so they
+    /// are not an atomic snapshot.
+    WorkerStats worker_stats(unsigned int worker_idx) const;
+
+    /// get the next open job. The job is handed over to the caller and considered complete by the pool.
     /// \return true if the job has been extracted, false otherwise
     bool get_next_job(Job &job);
 
     /// start the workers
     void start();
-    /// wait until all workers complete
+    /// wait until all the jobs are complete, or the pool is stopped
     void wait();
+    /// wait until all the jobs referencing the counter are complete.
+    /// \details jobs running in a fiber are parked until the counter reaches zero. The other workers help executing
+    /// the open jobs while waiting, starting from the jobs in their own queues (usually the children they spawned);
+    /// other threads sleep until notified.
+    void wait_for(JobCounter &counter);
+    /// decrease the counter as if a job referencing it had completed, notifying the waiting threads. Used for the
+    /// counters of events that are not jobs, e.g. the results of the futures (see future.h).
+    void signal(JobCounter &counter);
+
+    /// fork-join: add a child job, tracked by the given counter
+    ID spawn(const Job &job, JobCounter &counter, JobPriority priority=JobPriority::NORMAL, const CancellationToken *token=nullptr) {  return add_job(job,&counter,priority,token);  }
+    /// fork-join: wait for all the children spawned with the counter. A job calling sync() doesn't block its worker,
+    /// that executes other jobs in the meantime, so recursive algorithms can nest deeper than the number of workers.
+    void sync(JobCounter &counter) {  wait_for(counter);  }
     /// stop the execution
     void stop();
-    /// clear the queues
+    /// mark the calling job as blocked (I/O, locks, external events) until the returned object is destroyed:
+    /// an elastic pool adds a worker to run the queued jobs in the meantime. No effect outside the workers.
+    BlockingRegion blocking_region();
+    /// drop all the open jobs, as if they had been cancelled: their counters are completed and, in a ThreadPool,
+    /// the jobs depending on them are dropped too. Running and locked jobs are not affected.
     void clear();
 
+#if THREADPOOL_HAS_COROUTINES
+    /// \struct ScheduleAwaiter
+    /// \brief awaitable that suspends the calling coroutine and resumes it as a job of the pool
+    struct ScheduleAwaiter {
+        BasicThreadPool *pool;
+        JobPriority      priority;
+
+        bool await_ready() const noexcept {  return false;  }
+        void await_suspend(std::coroutine_handle<> handle) {  pool->add_job(Job(resume_coroutine,handle.address()),priority);  }
+        void await_resume() const noexcept {}
+    };
+    /// continue the calling coroutine on a worker: co_await pool.schedule()
+    ScheduleAwaiter schedule(JobPriority priority=JobPriority::NORMAL) {  return ScheduleAwaiter{this,priority};  }
+    /// job function resuming the coroutine whose address is stored in the local data
+    static void resume_coroutine(Job *job) {
+        void *address;
+        memcpy(&address,job->local_data,sizeof(address));
+        std::coroutine_handle<>::from_address(address).resume();
+    }
+#endif
+
 protected:
+    friend class BlockingRegion;
+
+    /// construct the pool, creating the workers only if start_workers is set. The workers call the virtual
+    /// execute_job(): derived pools call create_workers() themselves, once fully constructed.
+    BasicThreadPool(const ThreadPoolConfig &config, bool start_workers);
+
+    /// \struct Fiber
+    /// \brief fiber executing jobs, parked while its job waits for a counter
+    struct Fiber {
+        FiberContext     context;
+        FiberContext    *scheduler = nullptr;    ///< context of the worker that resumed the fiber
+        BasicThreadPool *pool = nullptr;
+        ID               job_id;                 ///< job to execute
+        JobCounter      *wait_counter = nullptr; ///< counter the parked job is waiting for
+    };
+
+    /// \struct WorkerData
+    /// \brief per-worker scheduling data
+    struct WorkerData {
+        WorkStealingQueue<ID> queues[num_job_priorities];  ///< jobs ready to be executed, pushed by the worker
+        uint32_t              rng_state = 1;               ///< state of the random generator used to pick the victims
+        uint32_t              num_acquired = 0;            ///< jobs acquired, used for the aging
+        bool                  high_priority_only = false;  ///< reserved to the HIGH level
+        Fiber                *free_fiber = nullptr;        ///< last fiber released by the worker, reused without locking
+        Semaphore             semaphore;                   ///< parked worker wake-up
+        unsigned int          cpu = UINT32_MAX;            ///< cpu the worker is pinned to, UINT32_MAX if not pinned
+        unsigned int          node = 0;                    ///< NUMA node of the worker
+        std::vector<unsigned int> victims;                 ///< the other workers, the ones of the same node first
+        unsigned int          num_local_victims = 0;       ///< number of victims in the same node
+        std::atomic<bool>     live{false};                 ///< a thread is running in this slot
+        bool                  retiring = false;            ///< the thread is exiting because idle (elastic pools)
+        // statistics, written only by the thread of the worker
+        std::atomic<uint64_t> jobs_run{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> idle_ns{0};
+        std::atomic<uint64_t> parked{0};
+        std::atomic<uint64_t> queue_high_water{0};
+    };
+
+    /// \struct TimerJob
+    /// \brief job waiting for its timer
+    struct TimerJob {
+        Job          job;
+        JobCounter  *counter = nullptr;
+        JobPriority  priority = JobPriority::NORMAL;
+    };
+
+    /// \struct NodeQueues
+    /// \brief jobs ready to be executed on a NUMA node, submitted from outside the workers of the node
+    struct NodeQueues {
+        std::mutex           mutex;
+        std::deque<ID>       queues[num_job_priorities];
+        std::atomic<int64_t> num_jobs[num_job_priorities]; ///< number of jobs in the queues, read without locking
+
+        NodeQueues() {
+            for (auto &n: num_jobs)
+                n = 0;
+        }
+    };
+
+    ThreadPoolConfig                         _config;
+    std::vector<std::unique_ptr<NodeQueues>> _node_queues;     /// shared queues, one set per NUMA node
+    std::vector<uint16_t>                    _cpu_nodes;       /// NUMA node of each cpu, used to place the jobs of the external threads
+    std::atomic<JobRing*>                    _rings[max_job_rings]; /// job storage: one ring per worker, then the shared rings
+    std::atomic<uint32_t>                    _num_rings;       /// number of created rings
+    uint32_t                                 _num_worker_rings;/// number of rings owned by the workers
+    std::mutex                               _rings_mutex;     /// sync mutex for the allocations from the shared rings
+    uint32_t                                 _shared_ring_hint;/// shared ring of the last allocation, relative to the first shared ring
+    std::vector<std::thread>                 _workers;         /// worker thread pool
+    std::vector<std::unique_ptr<WorkerData>> _worker_data;     /// scheduling data of the workers
+    std::atomic<ThreadPoolState>             _state;
+    std::atomic<int64_t>                     _num_open_jobs[num_job_priorities]; /// number of jobs in the queues, per level
+    std::atomic<uint32_t>                    _num_jobs;        /// number of allocated jobs
+    std::atomic<uint32_t>                    _num_spinning;    /// number of idle workers polling for new jobs
+    std::atomic<uint32_t>                    _num_spinning_high; /// number of idle reserved workers polling for new jobs
+    std::vector<unsigned int>                _parked;          /// parked workers, the last parked is woken up first
+    std::vector<unsigned int>                _parked_high;     /// parked reserved workers
+    std::atomic<uint32_t>                    _num_parked;      /// number of parked workers
+    std::mutex                               _park_mutex;      /// sync mutex for the parked workers
+    std::mutex                               _done_mutex;      /// sync mutex for the completion condition variable
+    std::condition_variable                  _done_cv;         /// condition variable used by wait() and wait_for() to get notified
+    std::atomic<uint32_t>                    _num_waiters;     /// number of threads waiting on the completion condition variable
+    std::vector<std::unique_ptr<Fiber>>      _fibers;          /// preallocated fibers, empty if the fibers are disabled
+    std::vector<Fiber*>                      _free_fibers;     /// fibers not running a job
+    std::vector<Fiber*>                      _waiting_fibers;  /// fibers parked by wait_for()
+    mutable std::mutex                       _fibers_mutex;    /// sync mutex for the fiber lists
+    std::atomic<uint32_t>                    _num_waiting_fibers; /// number of parked fibers
+    CancellationToken                        _cleared;         /// always cancelled token, assigned to the jobs dropped by clear()
+    std::atomic<uint32_t>                    _num_active;      /// number of running workers
+    std::atomic<uint32_t>                    _num_blocked;     /// number of workers in a blocking region
+    std::thread                              _manager;         /// elastic pools: thread adding the workers
+    std::mutex                               _manager_mutex;   /// sync mutex for the manager condition variable
+    std::condition_variable                  _manager_cv;      /// wakes up the manager when a worker blocks or the pool stops
+    TimerWheel<TimerJob>                     _timers;          /// delayed and periodic jobs
+    std::chrono::steady_clock::time_point    _timers_epoch;    /// time of the tick 0 of the timers
+    std::thread                              _timer_thread;    /// thread submitting the jobs of the expired timers, started with the first timer
+    mutable std::mutex                       _timers_mutex;    /// sync mutex for the timers
+    std::condition_variable                  _timers_cv;       /// wakes up the timer thread when a timer is added or the pool stops
+
+    /// create the workers and, for elastic pools, the manager thread
+    void create_workers();
+    /// create the scheduling data of the workers (up to max_workers); must be called before starting the worker threads
+    void create_worker_data(unsigned int num_worker_threads);
+    /// manager thread of the elastic pools
+    void manager_thread_function();
+    /// add a timer, starting the timer thread if needed
+    ID add_timer(std::chrono::nanoseconds delay, const TimerJob &timer_job, std::chrono::nanoseconds period);
+    /// timer thread: submit the jobs of the expired timers
+    void timer_thread_function();
+    /// current tick of the timers
+    uint64_t timer_tick() const;
+    /// start a worker in a free slot of an elastic pool
+    /// \return false if the pool has max_workers workers
+    bool spawn_worker();
+    void enter_blocking_region();
+    void leave_blocking_region();
+    /// worker thread
+    void worker_thread_function(unsigned int worker_idx);
+    /// worker loop with fibers: resume the parked fibers whose counters are done, otherwise run the next job in a free fiber
+    void fiber_scheduler(unsigned int worker_idx);
+    /// run a fiber until its job completes or waits, then release or park it
+    void run_fiber(WorkerData &worker, Fiber *fiber);
+    /// entry point of the fibers: execute a job, then return to the scheduler
+    static void fiber_function(void *fiber);
+    /// fiber running on the calling thread, nullptr if none
+    Fiber* current_fiber() const;
+    /// get a parked fiber whose counter is done
+    /// \return nullptr if there is no fiber to resume
+    Fiber* ready_fiber();
+    /// true if a parked fiber can be resumed
+    bool has_ready_fiber() const;
+    /// get a fiber to run a new job
+    /// \return nullptr if all the fibers are in use
+    Fiber* acquire_fiber(WorkerData &worker);
+    /// stop the workers and wait for their termination
+    void join_workers();
+    /// execute a job and complete it
+    virtual void execute_job(ID job_id);
+    /// call the function of a job, or discard the job if its token has been cancelled
+    void run_job(ID job_id, Job &job);
+    /// decrease the counter of a job, release it and notify the waiting threads
+    void complete_job(ID job_id);
+    /// decrease a counter, submitting the continuation of an awaiting coroutine, or waking up a worker to resume
+    /// the fibers waiting for it
+    /// \return true if the counter is done
+    bool release_counter(JobCounter &counter);
+    /// wake up the threads waiting for completions, if any
+    void notify_waiters();
+    /// get the next job to be executed by a worker, polling and then parking if there is no work. With fibers,
+    /// job_id is invalid if a parked fiber can be resumed instead.
+    /// \return false if the pool has been stopped
+    bool next_job(unsigned int worker_idx, ID &job_id);
+    /// try to get a job from the local queues, the shared queues or the other workers, higher levels first.
+    bool acquire_job(unsigned int worker_idx, ID &job_id);
+    /// try to get a job of the given level
+    bool acquire_job(unsigned int worker_idx, unsigned int level, ID &job_id);
+    /// try to get a job of the given level from the shared queues of a node
+    bool pop_node_job(unsigned int node, unsigned int level, ID &job_id);
+    /// try to steal a job of the given level from the victims [begin,end) of a worker, starting from a random one
+    bool steal_job(WorkerData &worker, unsigned int level, unsigned int begin, unsigned int end, ID &job_id);
+    /// NUMA node of the calling thread
+    unsigned int current_node() const;
+    /// try to get a job from the queues of the worker, higher levels first
+    bool pop_local_job(unsigned int worker_idx, ID &job_id);
+    /// true if there are open jobs the worker can execute, or parked fibers to resume
+    bool has_open_jobs(unsigned int worker_idx) const;
+    /// allocate a copy of the job, in the ring of the calling worker if possible. A locked job is allocated with an
+    /// extra unfinished job, and can be a parent (see ThreadPool::add_locked_job())
+    ID allocate_job(const Job &job, JobCounter *counter, JobPriority priority, unsigned int node, const CancellationToken *token, bool locked);
+    /// allocate copies of the jobs, in the ring of the calling worker if possible
+    void allocate_jobs(const Job *jobs, size_t count, JobCounter *counter, JobPriority priority, unsigned int node, const CancellationToken *token, bool locked, ID *ids);
+    /// allocate a copy of the job in the given ring
+    /// \return false if the ring is full
+    bool allocate_slot(uint32_t ring_idx, const Job &job, JobCounter *counter, JobPriority priority, unsigned int node, const CancellationToken *token, bool locked, ID &job_id);
+    /// take a reference on the parent of a new job: the parent must have been created locked (see
+    /// ThreadPool::add_locked_job()) and not be scheduled yet
+    /// \return false if the job can't be a parent
+    bool acquire_parent(ID parent_id);
+    /// get a job from its handle
+    /// \return nullptr if the job does not exist anymore
+    Job* get_job(ID job_id);
+    /// push a job id in the queue of the calling worker (or in the shared queue of its node) and wake up a worker
+    /// if needed
+    void enqueue(ID job_id);
+    /// push job ids of the given level in the queue of the calling worker (or in the shared queues of their nodes)
+    /// and wake up a worker per job, if needed
+    void enqueue(const ID *job_ids, size_t count, unsigned int level);
+    /// node of the queues for a job, given the node of the calling thread
+    unsigned int job_node(ID job_id, unsigned int local_node) const;
+    /// wake up one parked worker for each new job of the given level that the polling workers can't take
+    void wake_workers(size_t num_jobs, unsigned int level);
+    /// wake up all the parked workers
+    void wake_all_workers();
+    /// poll for new jobs, spinning and then yielding, according to the idle policy
+    /// \return true if a job has been acquired
+    bool poll_job(unsigned int worker_idx, ID &job_id);
+    /// park the worker until it is woken up by a submitter, start() or stop()
+    /// \return false if the worker has been idle for too long and must exit (elastic pools)
+    bool park(unsigned int worker_idx);
+};
 
-    std::deque<ID>           _open_jobs_queue; /// queue of the jobs that are ready to be executed
-    IDTable<Job>             _jobs;            /// table with all the jobs
-    std::vector<std::thread> _workers;         /// worker thread pool
-    std::mutex               _mutex;           /// sync mutex for the queue and the condition variable
-    std::condition_variable  _cv;              /// condition variable used by the workers to wait and get notified
-    ThreadPoolState          _state = ThreadPoolState::PAUSED;
 
-    /// worker thread
-    void worker_thread_function(void);
-    /// getthe next open job. This function is not thread safe.
-    bool get_next_job_unsafe(Job &job);
+/// \class BlockingRegion
+/// \brief scope in which a worker is blocked, see BasicThreadPool::blocking_region()
+class BlockingRegion {
+public:
+    explicit BlockingRegion(BasicThreadPool &pool);
+    BlockingRegion(BlockingRegion &&other)
+    : _pool(other._pool) {
+        other._pool = nullptr;
+    }
+    BlockingRegion(const BlockingRegion&) = delete;
+    ~BlockingRegion();
+
+private:
+    BasicThreadPool *_pool; ///< nullptr if the thread is not a worker of the pool
 };
 
+inline BlockingRegion BasicThreadPool::blocking_region() {
+    return BlockingRegion(*this);
+}
+
 
 /// \class ThreadPool
 /// \brief thread pool, with job dependencies
-/// \details jobs are scheduled only when all the dependent jobs are done.
+/// \details jobs are scheduled only when all the dependent jobs are done.\n
+/// Only the jobs created locked can be parents: a job naming as parent a job that was not created locked, or that
+/// has already been scheduled, is executed without notifying it.
 class ThreadPool: public BasicThreadPool {
 public:
     ThreadPool(unsigned int num_worker_threads);
+    ThreadPool(const ThreadPoolConfig &config);
     ThreadPool(const ThreadPool&) = delete;
     virtual ~ThreadPool();
 
-    /// add a job to the locked jobs queue. The number of unfinished jobs is set to 1, to avoid immediate execution.
+    /// add a locked job. The number of unfinished jobs is increased by 1, to avoid immediate execution.
     /// \return ID of the created job
-    ID add_locked_job(const Job &job);
-    /// close an open job. when an open job is closed, can be scheduled for execution.
-    /// This function will decrease the number of unfinished jobs of 1.
+    ID add_locked_job(const Job &job, JobCounter *counter=nullptr, JobPriority priority=JobPriority::NORMAL, const CancellationToken *token=nullptr);
+    /// unlock a locked job. This function will decrease the number of unfinished jobs by 1; the job is
+    /// scheduled for execution when it has no unfinished jobs.
     void unlock_job(ID job_id);
-
-    /// wait unti all workers complete
-    void wait();
-    /// clear the queues
-    void clear();
+    /// add a batch of locked jobs sharing the counter and the priority; ids receives the ids of the jobs
+    void add_locked_jobs(const Job *jobs, size_t count, ID *ids, JobCounter *counter=nullptr, JobPriority priority=JobPriority::NORMAL, const CancellationToken *token=nullptr);
+    /// unlock a batch of locked jobs; the jobs with no unfinished jobs are scheduled together
+    void unlock_jobs(const ID *job_ids, size_t count);
 
 protected:
 
-    std::set<ID> _locked_jobs; /// queue of the jobs that depend on unfinished jobs
-
-    /// worker thread
-    void worker_thread_function(void);
+    /// execute a job, notify its parent and complete it
+    virtual void execute_job(ID job_id);
 };
 
 //
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "common/foundation_types.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+/// \class TimerWheel
+/// \brief hierarchical timer wheel: timers with a payload, expiring at a given tick
+/// \details num_levels wheels of num_slots slots each; the slots of level l are num_slots^l ticks wide. A timer is
+/// linked in the slot of the lowest level covering its deadline, and moved to the lower levels (cascaded) as the
+/// wheel turns; timers beyond the range of the wheel are parked in the last level and cascaded again when reached.
+/// Insertion and cancellation are O(1) (the slot lists are intrusive and doubly linked); advancing skips the empty
+/// slots using a bitmap per level, and costs O(1) per cascaded or expired timer. Timers are referenced by handles with a generation, so stale handles
+/// are detected. The wheel is not thread safe.
+template <typename T>
+class TimerWheel {
+public:
+    static const uint32_t slot_bits = 6;
+    static const uint32_t num_slots = 1<<slot_bits;
+    static const uint32_t num_levels = 4;
+
+    explicit TimerWheel(uint64_t now=0)
+    : _now(now), _size(0) {
+        for (uint32_t l=0; l<num_levels; l++) {
+            _occupied[l] = 0;
+            for (auto &head: _heads[l])
+                head = UINT32_MAX;
+        }
+    }
+    TimerWheel(const TimerWheel&) = delete;
+
+    /// add a timer expiring at the given tick (at the next tick if already past), then every period ticks if not 0
+    /// \return handle of the timer
+    ID add(uint64_t deadline, const T &data, uint64_t period=0) {
+        uint32_t idx;
+        if (!_free.empty()) {
+            idx = _free.back();
+            _free.pop_back();
+        } else {
+            idx = _entries.size();
+            _entries.push_back(Entry());
+        }
+        Entry &e = _entries[idx];
+        e.data = data;
+        e.deadline = deadline;
+        e.period = period;
+        e.used = true;
+        link(idx,_now+1);
+        _size++;
+        return ID(idx,e.generation);
+    }
+    /// remove a timer
+    /// \return false if the timer does not exist (anymore)
+    bool cancel(ID id) {
+        if (!valid(id) || id.index>=_entries.size())
+            return false;
+        Entry &e = _entries[id.index];
+        if (!e.used || e.generation!=id.internal_id)
+            return false;
+        unlink(id.index);
+        release(id.index);
+        return true;
+    }
+    /// payload of a timer, nullptr if it does not exist
+    T* get(ID id) {
+        if (!valid(id) || id.index>=_entries.size())
+            return nullptr;
+        Entry &e = _entries[id.index];
+        return e.used && e.generation==id.internal_id ? &e.data : nullptr;
+    }
+    /// number of timers
+    size_t size() const {  return _size;  }
+    /// current tick
+    uint64_t now() const {  return _now;  }
+    /// tick of the next expiration or cascade, UINT64_MAX if the wheel is empty. Nothing happens before this tick.
+    uint64_t next_tick() const {
+        if (_size==0)
+            return UINT64_MAX;
+        // the first non empty slot after the current one, in the lowest non empty level
+        for (uint32_t l=0; l<num_levels; l++) {
+            if (_occupied[l]==0)
+                continue;
+            uint32_t shift = l*slot_bits;
+            uint32_t pos = (_now>>shift)&(num_slots-1);
+            uint64_t ahead = pos+1<num_slots ? _occupied[l]>>(pos+1)<<(pos+1) : 0;
+            if (ahead)
+                return ((_now>>(shift+slot_bits)<<slot_bits)+ctz(ahead))<<shift;
+            // only slots of the next turn: the wheel turns at the next slot of the level above
+            return ((_now>>(shift+slot_bits))+1)<<(shift+slot_bits);
+        }
+        return UINT64_MAX;
+    }
+    /// advance to the given tick, calling fn(id,data) for every expired timer in order of tick. Periodic timers are
+    /// scheduled again, the others are removed. fn must not modify the wheel.
+    template <typename F>
+    void advance(uint64_t tick, F &&fn) {
+        while (_now<tick) {
+            if (_size==0) {
+                _now = tick;
+                break;
+            }
+            // skip the ticks with nothing to expire or cascade
+            _now = std::min(next_tick(),tick);
+            if ((_now&(num_slots-1))==0) {
+                // cascade the slots of the higher levels that start at this tick
+                for (uint32_t l=1; l<num_levels; l++) {
+                    cascade(l,(_now>>(l*slot_bits))&(num_slots-1));
+                    if (((_now>>(l*slot_bits))&(num_slots-1))!=0)
+                        break;
+                }
+            }
+            expire(_now&(num_slots-1),fn);
+        }
+    }
+    /// remove all the timers, calling fn(id,data) for each of them
+    template <typename F>
+    void clear(F &&fn) {
+        for (uint32_t i=0; i<_entries.size(); i++) {
+            if (_entries[i].used) {
+                fn(ID(i,_entries[i].generation),_entries[i].data);
+                unlink(i);
+                release(i);
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        T        data;
+        uint64_t deadline = 0;
+        uint64_t period = 0;
+        uint32_t generation = 0;
+        uint32_t prev = UINT32_MAX;
+        uint32_t next = UINT32_MAX;
+        uint32_t list = 0;       ///< level*num_slots+slot
+        bool     used = false;
+    };
+
+    static uint32_t ctz(uint64_t v) {
+        uint32_t n = 0;
+        while ((v&1)==0) {
+            v >>= 1;
+            n++;
+        }
+        return n;
+    }
+
+    // link a timer in the slot covering its deadline, not earlier than the given tick
+    void link(uint32_t idx, uint64_t earliest) {
+        Entry &e = _entries[idx];
+        uint64_t deadline = std::max(e.deadline,earliest);
+        uint64_t delta = deadline-_now;
+        uint32_t level = 0;
+        while (level<num_levels-1 && delta>=(uint64_t(1)<<((level+1)*slot_bits)))
+            level++;
+        // beyond the range of the wheel: parked in the farthest slot of the last level
+        uint64_t max_delta = (uint64_t(1)<<(num_levels*slot_bits))-1;
+        if (delta>max_delta)
+            deadline = _now+max_delta;
+        uint32_t slot = (deadline>>(level*slot_bits))&(num_slots-1);
+        uint32_t &head = _heads[level][slot];
+        e.list = level*num_slots+slot;
+        e.prev = UINT32_MAX;
+        e.next = head;
+        if (head!=UINT32_MAX)
+            _entries[head].prev = idx;
+        head = idx;
+        _occupied[level] |= uint64_t(1)<<slot;
+    }
+    void unlink(uint32_t idx) {
+        Entry &e = _entries[idx];
+        uint32_t level = e.list/num_slots;
+        uint32_t slot = e.list%num_slots;
+        if (e.prev!=UINT32_MAX)
+            _entries[e.prev].next = e.next;
+        else
+            _heads[level][slot] = e.next;
+        if (e.next!=UINT32_MAX)
+            _entries[e.next].prev = e.prev;
+        if (_heads[level][slot]==UINT32_MAX)
+            _occupied[level] &= ~(uint64_t(1)<<slot);
+    }
+    void release(uint32_t idx) {
+        Entry &e = _entries[idx];
+        e.used = false;
+        e.generation++;
+        e.data = T();
+        _free.push_back(idx);
+        _size--;
+    }
+    // move the timers of a slot to the lower levels
+    void cascade(uint32_t level, uint32_t slot) {
+        uint32_t idx = _heads[level][slot];
+        _heads[level][slot] = UINT32_MAX;
+        _occupied[level] &= ~(uint64_t(1)<<slot);
+        while (idx!=UINT32_MAX) {
+            uint32_t next = _entries[idx].next;
+            // the timers due now land in the slot expiring in this tick
+            link(idx,_now);
+            idx = next;
+        }
+    }
+    template <typename F>
+    void expire(uint32_t slot, F &fn) {
+        uint32_t idx = _heads[0][slot];
+        _heads[0][slot] = UINT32_MAX;
+        _occupied[0] &= ~(uint64_t(1)<<slot);
+        while (idx!=UINT32_MAX) {
+            Entry &e = _entries[idx];
+            uint32_t next = e.next;
+            fn(ID(idx,e.generation),e.data);
+            if (e.period>0) {
+                e.deadline = std::max(e.deadline+e.period,_now+1);
+                link(idx,_now+1);
+            } else {
+                release(idx);
+            }
+            idx = next;
+        }
+    }
+
+    std::vector<Entry>    _entries;
+    std::vector<uint32_t> _free;
+    uint32_t              _heads[num_levels][num_slots]; ///< first timer of each slot
+    uint64_t              _occupied[num_levels];         ///< bitmaps of the non empty slots
+    uint64_t              _now;
+    size_t                _size;
+};
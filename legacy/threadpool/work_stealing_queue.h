@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common/foundation_types.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+
+/// \class WorkStealingQueue
+/// \brief fixed capacity lock-free work-stealing deque (Chase-Lev)
+/// \details the owner thread pushes and pops items at the bottom (LIFO order, good for cache locality),
+/// while any other thread can steal items from the top (FIFO order, taking the oldest and usually
+/// largest pieces of work).\n
+/// T must be trivially copyable. The implementation follows "Correct and Efficient Work-Stealing for
+/// Weak Memory Models" (Le et al., 2013), without resizing: push fails when the queue is full.
+template <typename T, unsigned int Capacity=4096>
+class WorkStealingQueue {
+    static_assert((Capacity & (Capacity-1))==0, "the capacity must be a power of 2");
+public:
+    WorkStealingQueue()
+    : _top(0), _bottom(0) {}
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+
+    /// add an item at the bottom. Can be called only by the owner thread.
+    /// \return false if the queue is full
+    bool push(const T &item);
+    /// extract the last pushed item. Can be called only by the owner thread.
+    /// \return false if the queue is empty
+    bool pop(T &item);
+    /// extract the oldest item. Can be called by any thread.
+    /// \return false if the queue is empty or another thread took the item concurrently
+    bool steal(T &item);
+
+    /// approximate number of items in the queue
+    size_t size() const {
+        int64_t n = _bottom.load(std::memory_order_relaxed)-_top.load(std::memory_order_relaxed);
+        return n>0 ? n : 0;
+    }
+    bool empty() const {  return size()==0;  }
+
+private:
+    std::atomic<int64_t> _top;    ///< next item to steal
+    char                 _pad0[CACHE_LINE_SIZE-sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t> _bottom; ///< next free position
+    char                 _pad1[CACHE_LINE_SIZE-sizeof(std::atomic<int64_t>)];
+    std::atomic<T>       _buffer[Capacity];
+};
+
+
+// WorkStealingQueue implementation
+template <typename T, unsigned int Capacity>
+bool WorkStealingQueue<T,Capacity>::push(const T &item) {
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_acquire);
+    if (b-t>=(int64_t)Capacity)
+        return false;
+    _buffer[b & (Capacity-1)].store(item,std::memory_order_relaxed);
+    // publish the item (and the data it refers to) to the thieves
+    _bottom.store(b+1,std::memory_order_release);
+    return true;
+}
+
+template <typename T, unsigned int Capacity>
+bool WorkStealingQueue<T,Capacity>::pop(T &item) {
+    int64_t b = _bottom.load(std::memory_order_relaxed)-1;
+    _bottom.store(b,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+    if (t>b) {
+        // empty queue
+        _bottom.store(b+1,std::memory_order_relaxed);
+        return false;
+    }
+    item = _buffer[b & (Capacity-1)].load(std::memory_order_relaxed);
+    if (t==b) {
+        // last item: race against the thieves
+        bool won = _top.compare_exchange_strong(t,t+1,std::memory_order_seq_cst,std::memory_order_relaxed);
+        _bottom.store(b+1,std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template <typename T, unsigned int Capacity>
+bool WorkStealingQueue<T,Capacity>::steal(T &item) {
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = _bottom.load(std::memory_order_acquire);
+    if (t>=b)
+        return false;
+    item = _buffer[t & (Capacity-1)].load(std::memory_order_relaxed);
+    return _top.compare_exchange_strong(t,t+1,std::memory_order_seq_cst,std::memory_order_relaxed);
+}